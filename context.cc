@@ -3,6 +3,7 @@
 #include "libpstack/context.h"
 #include "libpstack/dwarf.h"
 #include "libpstack/reader.h"
+#include "libpstack/zstdreader.h"
 #if defined(WITH_LZ4)
 #include "libpstack/lz4reader.h"
 #endif
@@ -141,15 +142,33 @@ Context::findDwarf(const Elf::BuildID &bid)
 Dwarf::Info::sptr
 Context::findDwarf(Elf::Object::sptr object)
 {
+    std::unique_lock guard(cacheLock);
     auto it = dwarfCache.find(object);
     counters.dwarfLookups++;
     if (it != dwarfCache.end()) {
         counters.dwarfHits++;
-        return it->second;
+        auto pending = it->second;
+        guard.unlock();
+        return pending.get();
+    }
+    // Creating the Info may load the debug image: don't hold up lookups for
+    // other objects while we do. Anyone wanting this object's Info meanwhile
+    // waits for ours.
+    std::promise<Dwarf::Info::sptr> promise;
+    dwarfCache.emplace(object, promise.get_future().share());
+    guard.unlock();
+    try {
+        auto dwarf = std::make_shared<Dwarf::Info>(object);
+        promise.set_value(dwarf);
+        return dwarf;
+    }
+    catch (...) {
+        // Let the waiters see the failure, but let later lookups retry.
+        promise.set_exception(std::current_exception());
+        guard.lock();
+        dwarfCache.erase(object);
+        throw;
     }
-    auto dwarf = std::make_shared<Dwarf::Info>(object);
-    dwarfCache[object] = dwarf;
-    return dwarf;
 }
 
 Context::~Context() noexcept {
@@ -181,6 +200,7 @@ void
 Context::flush(std::shared_ptr<Elf::Object> o)
 {
     // Flush references to "o" out of any caches.
+    std::lock_guard guard(cacheLock);
     auto flushmap = [&o](auto &map) {
         for (auto it = map.begin(), next = it; it != map.end(); it = next) {
             if (it->second == o)
@@ -231,10 +251,14 @@ Context::openImage(const std::filesystem::path &path, int fd, bool isDebug) {
  */
 std::shared_ptr<Elf::Object>
 Context::getImageInPath(const std::vector<std::filesystem::path> &paths, NameMap &container, const std::filesystem::path &name, bool isDebug, bool resolveLink) {
+    std::unique_lock guard(cacheLock);
     std::optional<Elf::Object::sptr> cached = getImageIfLoaded(container, name, isDebug);
     if (cached)
         return *cached;
 
+    // Search for and open the file without the lock, so images can be opened
+    // concurrently.
+    guard.unlock();
     Elf::Object::sptr res;
     // Walk through these backwards - prefer user specified values to defaults.
     for (const auto &dir : std::views::reverse(paths)) {
@@ -264,8 +288,9 @@ Context::getImageInPath(const std::vector<std::filesystem::path> &paths, NameMap
         else
             *debug << "no image found for " << name << " in any of " << json(paths) << "\n";
     }
-    container[name] = res;
-    return res;
+    guard.lock();
+    // If another thread opened the same image meanwhile, prefer its copy.
+    return container.try_emplace(name, res).first->second;
 }
 
 /*
@@ -294,6 +319,7 @@ std::shared_ptr<Elf::Object> Context::getImageImpl( const Elf::BuildID &bid, boo
     Elf::Object::sptr res;
     if (!bid || options.noBuildIds)
         return nullptr;
+    std::unique_lock guard(cacheLock);
     IdMap &container = isDebug ? debugImageByID : imageByID;
 
     std::optional<Elf::Object::sptr> cached = getImageIfLoaded( container, bid, isDebug );
@@ -301,6 +327,9 @@ std::shared_ptr<Elf::Object> Context::getImageImpl( const Elf::BuildID &bid, boo
         return *cached;
 
     if (!options.noLocalFiles) {
+        // getImageInPath drops the lock while it opens files: we must not
+        // hold it ourselves.
+        guard.unlock();
         NameMap &nameContainer = isDebug ? debugImageByName : imageByName;
         std::vector<std::filesystem::path> &paths = isDebug ? debugBuildIdPrefixes : exeBuildIdPrefixes;
 
@@ -313,6 +342,7 @@ std::shared_ptr<Elf::Object> Context::getImageImpl( const Elf::BuildID &bid, boo
 
         std::filesystem::path bidpath = std::filesystem::path( bucket.str() ) / std::filesystem::path( rest.str() );
         res = getImageInPath(paths, nameContainer, bidpath, isDebug, true);
+        guard.lock();
     }
     if (!res && getDebuginfodClient()) {
         char *path = nullptr;
@@ -333,8 +363,7 @@ std::shared_ptr<Elf::Object> Context::getImageImpl( const Elf::BuildID &bid, boo
             *debug << "failed to fetch image for " << bid << " with debuginfod: " << strerror(-fd) << "\n";
         }
     }
-    container[bid] = res; // cache it.
-    return res;
+    return container.try_emplace(bid, res).first->second; // cache it.
 }
 
 std::shared_ptr<Elf::Object>
@@ -355,10 +384,17 @@ Context::loadFile(const std::filesystem::path &path) {
     {
         return std::make_shared<CacheReader>(
             std::make_shared<Lz4Reader>(
-                std::make_shared<FileReader>(*this, path)));
+                std::make_shared<FileReader>(*this, path), options.lz4CacheSize), CacheReader::fileConfig);
     }
 #endif
-    return std::make_shared<CacheReader>( std::make_shared<FileReader>(*this, path));
+    auto file = std::make_shared<FileReader>(*this, path);
+    if (isZstd(*file)) {
+        if (zstdAvailable())
+            return std::make_shared<CacheReader>(std::make_shared<ZstdReader>(file), CacheReader::fileConfig);
+        if (debug)
+            *debug << "warning: " << path << " is zstd compressed, but zstd is not available at runtime\n";
+    }
+    return std::make_shared<CacheReader>(file, CacheReader::fileConfig);
 }
 
 std::filesystem::path
@@ -7,16 +7,15 @@ namespace pstack::Dwarf {
 
 class DIE::Raw {
     const Abbreviation *type;
-    std::vector<DIE::Attribute::Value> values;
+    DIE::Attribute::Value *values; // one for each of type->forms, in the arena.
     Elf::Off parent; // 0 implies we do not yet know the parent's offset.
     Elf::Off firstChild;
     Elf::Off nextSibling;
 public:
-    Raw(Unit *unit, DWARFReader &r, size_t abbr, Elf::Off parent);
-    ~Raw();
+    Raw(Unit *unit, DIEArena &arena, DWARFReader &r, size_t abbr, Elf::Off parent);
+    ~Raw() = default;
     // Mostly, Raw DIEs are hidden from everything. DIE needs access though
     friend class DIE;
-    static std::shared_ptr<Raw> decode(Unit *unit, const DIE &parent, Elf::Off offset);
 
     // rule-of-three
     Raw() = delete;
@@ -37,14 +36,9 @@ DIE::nextSibling(const DIE &parent) const
 {
 
     if (raw->nextSibling == 0) {
-        // Need to work out what the next sibling is, and we don't have DW_AT_sibling
-        // Run through all our children. decodeEntries will update the
-        // parent's (our) nextSibling.
-        std::shared_ptr<Raw> last = nullptr;
-        for (const auto &it : children())
-            last = it.raw;
-        if (last)
-            last->nextSibling = 0;
+        // Need to work out what the next sibling is, and we don't have
+        // DW_AT_sibling. Skip over all our descendants to find it.
+        raw->nextSibling = unit->skipEntries(raw->firstChild);
     }
     return unit->offsetToDIE(parent, raw->nextSibling);
 }
@@ -118,10 +112,6 @@ DIE::attribute(AttrName name, bool local) const
        bool operator()(const AttrName lhs, const Abbreviation::AttrNameEnt &rhs) const { return lhs < rhs.first; }
        bool operator()(const Abbreviation::AttrNameEnt &lhs, const AttrName rhs) const { return lhs.first < rhs; }
     };
-    if (!raw->type->sorted) {
-       std::sort(raw->type->attrName2Idx.begin(), raw->type->attrName2Idx.end());
-       raw->type->sorted = true;
-    }
     auto loc = std::lower_bound(
           raw->type->attrName2Idx.begin(),
           raw->type->attrName2Idx.end(),
@@ -155,16 +145,17 @@ DIE::name() const
     return attr.valid() ? std::string(attr) : "";
 }
 
-DIE::Raw::Raw(Unit *unit, DWARFReader &r, size_t abbrev, Elf::Off parent_)
+DIE::Raw::Raw(Unit *unit, DIEArena &arena, DWARFReader &r, size_t abbrev, Elf::Off parent_)
     : type(unit->findAbbreviation(abbrev))
+    , values(static_cast<DIE::Attribute::Value *>(arena.allocate(
+                type->forms.size() * sizeof (DIE::Attribute::Value), alignof (DIE::Attribute::Value))))
     , parent(parent_)
     , firstChild(0)
     , nextSibling(0)
 {
     size_t i = 0;
-    values.reserve(type->forms.size());
     for (const auto &form : type->forms) {
-        values.emplace_back(r, form, unit);
+        new (values + i) DIE::Attribute::Value(r, form, unit, arena);
         if (int(i) == type->nextSibIdx)
             nextSibling = values[i].sdata + unit->offset;
         ++i;
@@ -178,7 +169,7 @@ DIE::Raw::Raw(Unit *unit, DWARFReader &r, size_t abbrev, Elf::Off parent_)
     }
 }
 
-DIE::Attribute::Value::Value(DWARFReader &r, const FormEntry &forment, Unit *unit)
+DIE::Attribute::Value::Value(DWARFReader &r, const FormEntry &forment, Unit *unit, DIEArena &arena)
 {
     switch (forment.form) {
 
@@ -272,21 +263,21 @@ DIE::Attribute::Value::Value(DWARFReader &r, const FormEntry &forment, Unit *uni
         break;
 
     case DW_FORM_block1:
-        block = new Block();
+        block = arena.make<Block>();
         block->length = r.getu8();
         block->offset = r.getOffset();
         r.skip(block->length);
         break;
 
     case DW_FORM_block2:
-        block = new Block();
+        block = arena.make<Block>();
         block->length = r.getu16();
         block->offset = r.getOffset();
         r.skip(block->length);
         break;
 
     case DW_FORM_block4:
-        block = new Block();
+        block = arena.make<Block>();
         block->length = r.getu32();
         block->offset = r.getOffset();
         r.skip(block->length);
@@ -294,7 +285,7 @@ DIE::Attribute::Value::Value(DWARFReader &r, const FormEntry &forment, Unit *uni
 
     case DW_FORM_exprloc:
     case DW_FORM_block:
-        block = new Block();
+        block = arena.make<Block>();
         block->length = r.getuleb128();
         block->offset = r.getOffset();
         r.skip(block->length);
@@ -325,22 +316,54 @@ DIE::Attribute::Value::Value(DWARFReader &r, const FormEntry &forment, Unit *uni
     }
 }
 
-DIE::Raw::~Raw()
+void *
+DIEArena::allocate(size_t size, size_t align)
 {
-    int i = 0;
-    for (const auto &forment : type->forms) {
-        switch (forment.form) {
-            case DW_FORM_exprloc:
-            case DW_FORM_block:
-            case DW_FORM_block1:
-            case DW_FORM_block2:
-            case DW_FORM_block4:
-                delete values[i].block;
-                break;
-            default:
-                break;
-        }
-        ++i;
+    static constexpr size_t chunkSize = 64 * 1024;
+    size_t pad = -reinterpret_cast<uintptr_t>(next) & (align - 1);
+    if (size + pad > avail) {
+        // Oversized requests get a chunk of their own.
+        size_t newSize = std::max(chunkSize, size + align);
+        chunks.push_back(std::make_unique<char[]>(newSize));
+        next = chunks.back().get();
+        avail = newSize;
+        pad = -reinterpret_cast<uintptr_t>(next) & (align - 1);
+    }
+    void *p = next + pad;
+    next += pad + size;
+    avail -= pad + size;
+    return p;
+}
+
+DIE::Raw **
+DIEArena::find(Elf::Off offset)
+{
+    auto cmp = [](const Entry &ent, Elf::Off off) { return ent.first < off; };
+    for (auto *entries : { &sorted, &recent }) {
+        auto it = std::lower_bound(entries->begin(), entries->end(), offset, cmp);
+        if (it != entries->end() && it->first == offset)
+            return &it->second;
+    }
+    return nullptr;
+}
+
+void
+DIEArena::insert(Elf::Off offset, DIE::Raw *raw)
+{
+    if (sorted.empty() || sorted.back().first < offset) {
+        sorted.emplace_back(offset, raw);
+        return;
+    }
+    auto cmp = [](const Entry &ent, Elf::Off off) { return ent.first < off; };
+    recent.emplace(std::lower_bound(recent.begin(), recent.end(), offset, cmp), offset, raw);
+    // Merging is linear in the size of the index, so let "recent" grow with
+    // it, keeping the amortized cost of insertion down.
+    if (recent.size() * recent.size() > sorted.size() && recent.size() > 64) {
+        auto mid = sorted.size();
+        sorted.insert(sorted.end(), recent.begin(), recent.end());
+        std::inplace_merge(sorted.begin(), sorted.begin() + mid, sorted.end(),
+              [](const Entry &l, const Entry &r) { return l.first < r.first; });
+        recent.clear();
     }
 }
 
@@ -369,8 +392,8 @@ DIE::getParentOffset() const
     return raw->parent;
 }
 
-std::shared_ptr<DIE::Raw>
-DIE::decode(Unit *unit, const DIE &parent, Elf::Off offset)
+DIE::Raw *
+DIE::decode(Unit *unit, DIEArena &arena, const DIE &parent, Elf::Off offset)
 {
     DWARFReader r(unit->dwarf->debugInfo.io(), offset);
     size_t abbrev = r.getuleb128();
@@ -381,7 +404,7 @@ DIE::decode(Unit *unit, const DIE &parent, Elf::Off offset)
             parent.raw->nextSibling = r.getOffset();
         return nullptr;
     }
-    return std::make_shared<DIE::Raw>(unit, r, abbrev, parent.getOffset());
+    return arena.make<DIE::Raw>(unit, arena, r, abbrev, parent.getOffset());
 }
 
 DIE::Children::const_iterator &DIE::Children::const_iterator::operator++() {
@@ -674,7 +697,7 @@ DIE::Attributes::end() const {
 }
 
 const DIE::Attribute::Value &DIE::Attribute::value() const {
-    return die.raw->values.at(formp - die.raw->type->forms.data());
+    return die.raw->values[formp - die.raw->type->forms.data()];
 }
 
 Tag DIE::tag() const {
@@ -685,6 +708,27 @@ bool DIE::hasChildren() const {
     return raw->type->hasChildren;
 }
 
+std::string
+DIE::qualifiedName() const
+{
+    auto spec = attribute(DW_AT_specification, true);
+    if (spec.valid())
+        return DIE(spec).qualifiedName();
+    std::string qualified = name();
+    for (DIE scope = *this; !unit->isRoot(scope);) {
+        scope = unit->offsetToDIE(DIE(), scope.getParentOffset());
+        auto tag = scope.tag();
+        if (tag != DW_TAG_namespace && tag != DW_TAG_structure_type
+              && tag != DW_TAG_class_type && tag != DW_TAG_union_type)
+            break; // the unit, or some other scope that isn't part of the name.
+        auto scopeName = scope.name();
+        if (scopeName.empty() && tag == DW_TAG_namespace)
+            scopeName = "(anonymous namespace)";
+        qualified = scopeName + "::" + qualified;
+    }
+    return qualified;
+}
+
 std::string
 DIE::typeName() const
 {
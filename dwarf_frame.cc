@@ -156,116 +156,156 @@ CFI::CFI(const Info *info, FIType type_)
         return;
     io = cfiFrame.io();
 
-    do {
-
-       // If we are using .eh_frame and have .eh_frame_hdr, we can use
-       // the sorted header later to read the FDEs lazily.
-       if ( type != FI_EH_FRAME )
-          break;
-       if (!ehFrameHdrSec)
-           break;
-       if (getenv("NO_EH_FRAME_HDR"))
-          break;
-       DWARFReader hdr( ehFrameHdrSec.io() );
-
-       /* auto version = */ hdr.getu8();
-       auto ptrEnc = hdr.getu8();
-       auto fdeCountEnc = hdr.getu8();
-       fdeTableEnc = ExceptionHandlingEncoding(hdr.getu8());
-
-       // We are mostly interested in the FDE search table. return if it's not there.
-       auto enc = fdeTableEnc & 0x0f;
-       if ( enc == DW_EH_PE_omit || (0xf & fdeCountEnc ) == DW_EH_PE_omit )
-          break;
+    // If we are using .eh_frame and have .eh_frame_hdr, we can use its
+    // sorted search table as our index.
+    if (type != FI_EH_FRAME || !ehFrameHdrSec || getenv("NO_EH_FRAME_HDR")
+          || !indexFromHeader(ehFrameHdrSec)) {
+       if (info->elf->context.verbose)
+          *info->elf->context.debug << "no usable .eh_frame_hdr, indexing FDEs from section for "
+             << *dwarf->elf->io << "\n";
+       indexFromSection();
+    }
+    fdes.resize(fdeLocations.size());
+}
 
-       if (sizeForEncoding(fdeTableEnc) == 0) {
-          // table needs to use a fixed-size encoding so we can binary search it.
-          break;
+bool
+CFI::indexFromHeader(const Elf::Section &ehFrameHdrSec) {
+    DWARFReader hdr( ehFrameHdrSec.io() );
+
+    /* auto version = */ hdr.getu8();
+    auto ptrEnc = hdr.getu8();
+    auto fdeCountEnc = hdr.getu8();
+    auto tableEnc = ExceptionHandlingEncoding(hdr.getu8());
+
+    // We are mostly interested in the FDE search table. return if it's not there.
+    auto enc = tableEnc & 0x0f;
+    if ( enc == DW_EH_PE_omit || (0xf & fdeCountEnc ) == DW_EH_PE_omit )
+       return false;
+
+    // table needs to use a fixed-size encoding so we can binary search it.
+    size_t entrySize = sizeForEncoding(tableEnc);
+    if (entrySize == 0)
+       return false;
+
+    // datarel encodings are relative to this VA.
+    Elf::Addr hdrAddr = ehFrameHdrSec.shdr.sh_addr;
+
+    // We don't really care about this - it should be just a pointer to the
+    // eh_frame section we already got by name from the ELF object.
+    decodeAddress( hdr, ptrEnc, hdrAddr );
+    auto [fdeTableSize, indirectTable] = decodeAddress( hdr, fdeCountEnc, 0);
+    Elf::Off tableOff = hdr.getOffset();
+    fdeTableSize = std::min(fdeTableSize, (ehFrameHdrSec.io()->size() - tableOff) / (2 * entrySize));
+
+    fdeLocations.resize(fdeTableSize);
+    fdeOffsets.resize(fdeTableSize);
+    if (tableEnc == (DW_EH_PE_datarel | DW_EH_PE_sdata4)) {
+       // This is what every linker we know of generates: read the whole
+       // table at once, and convert it with a simple loop.
+       std::vector<int32_t> table(fdeTableSize * 2);
+       ehFrameHdrSec.io()->readObj(tableOff, table.data(), table.size());
+       for (size_t i = 0; i < fdeTableSize; ++i) {
+          fdeLocations[i] = hdrAddr + table[i * 2];
+          fdeOffsets[i] = hdrAddr + table[i * 2 + 1] - sectionAddr;
        }
+    } else {
+       DWARFReader tableReader( ehFrameHdrSec.io(), tableOff );
+       for (size_t i = 0; i < fdeTableSize; ++i) {
+          fdeLocations[i] = decodeAddress(tableReader, tableEnc, hdrAddr).first;
+          fdeOffsets[i] = decodeAddress(tableReader, tableEnc, hdrAddr).first - sectionAddr;
+       }
+    }
+    return std::ranges::is_sorted(fdeLocations);
+}
 
-       // datarel encodings are relative to this VA.
-       ehFrameHdrAddr = ehFrameHdrSec.shdr.sh_addr;
-
-       // We don't really care about this - it should be just a pointer to the
-       // eh_frame section we already got by name from the ELF object.
-       decodeAddress( hdr, ptrEnc, ehFrameHdrSec.shdr.sh_addr );
-       auto [fdeTableSize, indirectTable]= decodeAddress( hdr, fdeCountEnc, 0);
-
-       fdeTable = ehFrameHdrSec.io()->view("FDE search table", hdr.getOffset(),
-               ehFrameHdrSec.io()->size() - hdr.getOffset());
-       // empty pointers will be filled when searching from fdeTable
-       fdes.resize(fdeTableSize);
-       return;
-
-    } while( false );
-
-    // No usable eh_frame_hdr found. Read everything now so we can search it.
-
-    if (info->elf->context.verbose)
-       *info->elf->context.debug << "fall back to full-FDE decoding for " << *dwarf->elf->io << "\n";
-
-    // Walk the entire CIE/FDE sequence, populating the fdes and cies sets as
-    // we go. This really only happens for the VDSO on arm.
+// Build the index by walking the CIE/FDE headers in the section. CIEs are
+// decoded as we go, as we need their address encoding to find the FDEs'
+// initial locations, but FDEs are not.
+void
+CFI::indexFromSection() {
+    fdeLocations.clear();
+    fdeOffsets.clear();
+    std::vector<std::pair<Elf::Addr, Elf::Off>> entries;
     DWARFReader reader(io);
     while (!reader.empty()) {
-       auto [success, fde] = putFDEorCIE(reader);
-       if (!success)
+       Elf::Off start = reader.getOffset();
+       Elf::Off cieOff;
+       Elf::Off next = decodeCIEFDEHdr(reader, type, &cieOff);
+       if (next == 0)
           break;
-       if (fde != nullptr) // skip CIEs.
-          fdes.push_back(std::move(fde));
+       if (cieOff == Elf::Off(-1)) {
+          putCIE(start, reader, next);
+       } else {
+          auto cie = cies.find(cieOff);
+          if (cie == cies.end()) {
+             DWARFReader cieReader( io, cieOff );
+             putFDEorCIE(cieReader);
+             cie = cies.find(cieOff);
+             if (cie == cies.end())
+                throw (Exception() << "FDE at offset " << start << " refers to missing CIE at " << cieOff);
+          }
+          auto [iloc, indirect] = decodeAddress(reader, cie->second.addressEncoding, sectionAddr);
+          if (indirect)
+             throw (Exception() << "FDE has indirect encoding for location");
+          entries.emplace_back(iloc, start);
+       }
+       reader.setOffset(next);
+    }
+    std::ranges::sort(entries);
+    fdeLocations.reserve(entries.size());
+    fdeOffsets.reserve(entries.size());
+    for (auto [iloc, offset] : entries) {
+       fdeLocations.push_back(iloc);
+       fdeOffsets.push_back(offset);
     }
-    std::sort(fdes.begin(), fdes.end(),
-          [](std::unique_ptr<FDE> &l, std::unique_ptr<FDE> &r) {
-          return l->iloc < r->iloc; });
 }
 
-
 void
 CFI::ensureFDE(size_t idx) const {
    auto &entry = fdes[idx];
    if (entry != nullptr)
       return;
-   size_t encodingSize = sizeForEncoding( ExceptionHandlingEncoding(fdeTableEnc) );
-   DWARFReader tableReader( fdeTable, encodingSize * 2 * idx );
-   auto [fdeAddr,indirectAddr] = decodeAddress(tableReader, fdeTableEnc, ehFrameHdrAddr);
-   (void)fdeAddr;
-   (void)indirectAddr;
-   auto [fdeOff,indirectOff] = decodeAddress(tableReader, fdeTableEnc, ehFrameHdrAddr);
-   DWARFReader fdeReader( io, fdeOff - sectionAddr );
+   DWARFReader fdeReader( io, fdeOffsets[idx] );
    auto [ success, newEntry ] = putFDEorCIE( fdeReader );
+   if (!success || newEntry == nullptr)
+      throw (Exception() << "no FDE at offset " << fdeOffsets[idx] << " of " << *io);
    entry = std::move(newEntry);
-   assert(fdeAddr == entry->iloc);
+   assert(fdeLocations[idx] == entry->iloc);
 }
 
 void
 CFI::ensureFDEs() const {
-   if (fdeTable == nullptr)
-      return;
+   std::lock_guard guard(fdeLock);
    for (size_t i = 0; i < fdes.size(); ++i)
       ensureFDE(i);
-   fdeTable.reset(); // We don't need this anymore, as we've read all the FDEs.
 }
 
 const FDE *
 CFI::findFDE(Elf::Addr addr) const {
+   // Find the last FDE starting at or before addr. The loop compiles to
+   // conditional moves rather than branches.
+   size_t count = fdeLocations.size();
+   if (count == 0 || addr < fdeLocations[0])
+      return nullptr;
+   const Elf::Addr *base = fdeLocations.data();
+   while (count > 1) {
+      size_t half = count / 2;
+      base = base[half] <= addr ? base + half : base;
+      count -= half;
+   }
 
-   // No FDE found. Check the lookup table.
-   uintptr_t start = 0;
-   uintptr_t end = fdes.size();
-
-   while (start < end) {
-      auto mid = start + (end - start) / 2;
-      ensureFDE(mid);
-      auto &entry = fdes[mid];
-      if (entry->iloc <= addr) {
-         start = mid + 1;
-         if (addr < entry->iloc + entry->irange)
-            return entry.get();
-      } else {
-         end = mid;
-      }
+   // Only now decode the FDE, and make sure it covers the address. Zero
+   // sized FDEs may share a location with the one we want, so check any
+   // others that start at the same place.
+   std::lock_guard guard(fdeLock);
+   for (size_t idx = base - fdeLocations.data();; --idx) {
+      ensureFDE(idx);
+      const FDE *fde = fdes[idx].get();
+      if (addr < fde->iloc + fde->irange)
+         return fde;
+      if (idx == 0 || fdeLocations[idx - 1] != fdeLocations[idx])
+         return nullptr;
    }
-   return nullptr;
 }
 
 CallFrame::CallFrame()
@@ -296,6 +336,64 @@ FDE::execInsns(uintmax_t addr) const {
          [addr](uintmax_t insnAddr, CallFrame &) { return addr < insnAddr; });
 }
 
+const UnwindTable &
+FDE::unwindTable() const {
+   std::call_once(tableBuilt, [this] { table = std::make_unique<UnwindTable>(*this); });
+   return *table;
+}
+
+UnwindTable::UnwindTable(const FDE &fde)
+   : end(fde.iloc + fde.irange)
+{
+   // The yield function is called before each instruction. Whenever the
+   // location has moved on, the frame describes everything from the start of
+   // the current row up to the new location.
+   Elf::Addr rowStart = fde.iloc;
+   auto last = fde.cie.execInsns(fde.defaultFrame(), fde.instructions, fde.end, fde.iloc,
+         [this, &rowStart](uintmax_t insnAddr, CallFrame &frame) {
+            if (insnAddr != rowStart) {
+               addRow(rowStart, frame);
+               rowStart = insnAddr;
+            }
+            return false;
+         });
+   addRow(rowStart, last);
+}
+
+void
+UnwindTable::addRow(Elf::Addr start, const CallFrame &frame) {
+   // DW_CFA_set_loc can, in theory, move backwards: keep the rows sorted by
+   // replacing any we've passed.
+   while (!rows.empty() && rows.back().start >= start) {
+      ruleStore.resize(rows.back().firstRule);
+      rows.pop_back();
+   }
+   UnwindRow &row = rows.emplace_back(UnwindRow{ start, frame.cfaReg, frame.cfaValue,
+         uint32_t(ruleStore.size()), uint32_t(frame.registers.size()) });
+   ruleStore.insert(ruleStore.end(), frame.registers.begin(), frame.registers.end());
+   std::sort(ruleStore.begin() + row.firstRule, ruleStore.end(),
+         [](const Rule &lhs, const Rule &rhs) { return lhs.first < rhs.first; });
+}
+
+const UnwindRow *
+UnwindTable::rowForAddr(Elf::Addr addr) const {
+   if (addr >= end)
+      return nullptr;
+   auto it = std::upper_bound(rows.begin(), rows.end(), addr,
+         [](Elf::Addr addr, const UnwindRow &row) { return addr < row.start; });
+   return it == rows.begin() ? nullptr : &*std::prev(it);
+}
+
+const RegisterUnwind *
+UnwindTable::findRule(const UnwindRow &row, int reg) const {
+   auto rowRules = rules(row);
+   auto it = std::lower_bound(rowRules.begin(), rowRules.end(), reg,
+         [](const Rule &rule, int reg) { return rule.first < reg; });
+   return it != rowRules.end() && it->first == reg ? &it->second : nullptr;
+}
+
+FDE::~FDE() = default;
+
 FDE::FDE(const CFI &fi, DWARFReader &reader, Elf::Off cieOff, Elf::Off endOff_)
     : end(endOff_)
     , cie(fi.cies.at( cieOff ))
@@ -1,11 +1,17 @@
 #include "libpstack/dwarf.h"
+#include "libpstack/concurrency.h"
 #include "libpstack/stringify.h"
 #include <memory>
+#include <set>
 #include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
 
 namespace pstack::Dwarf {
 
 CFI *Info::getCFI(FIType type) const {
+   std::lock_guard guard(cfiLock);
    for (auto candidate : { FI_EH_FRAME,  FI_DEBUG_FRAME } ) {
       if (candidate != type && type != FI_BEST)
          continue;
@@ -41,21 +47,171 @@ Info::sourceFromAddr(uintmax_t addr) const
     return info;
 }
 
+namespace {
+void
+readPubnames(const Elf::Section &section, std::list<PubnameUnit> &units)
+{
+    if (section) {
+        DWARFReader r(section.io());
+        while (!r.empty())
+            units.emplace_back(r);
+    }
+}
+}
+
 const std::list<PubnameUnit> &
 Info::pubnames() const
 {
     if (pubnameUnits == nullptr) {
         pubnameUnits = std::make_unique<std::list<PubnameUnit>>();
-        const Elf::Section &pubnamesh = elf->getDebugSection(".debug_pubnames", SHT_NULL);
-        if (pubnamesh) {
-            DWARFReader r(pubnamesh.io());
-            while (!r.empty())
-                pubnameUnits->emplace_back(r);
-        }
+        readPubnames(elf->getDebugSection(".debug_pubnames", SHT_NULL), *pubnameUnits);
     }
     return *pubnameUnits;
 }
 
+const std::list<PubnameUnit> &
+Info::pubtypes() const
+{
+    if (pubtypeUnits == nullptr) {
+        pubtypeUnits = std::make_unique<std::list<PubnameUnit>>();
+        readPubnames(elf->getDebugSection(".debug_pubtypes", SHT_NULL), *pubtypeUnits);
+    }
+    return *pubtypeUnits;
+}
+
+namespace {
+// Call "f" for each DIE defining a named entity among "parent"'s children,
+// looking into namespaces, but not into other scopes.
+template <typename F> void
+forEachDefinition(const DIE &parent, const F &f)
+{
+    for (auto child : parent.children()) {
+        if (child.tag() == DW_TAG_namespace)
+            forEachDefinition(child, f);
+        else if (!child.attribute(DW_AT_declaration).valid())
+            f(child);
+    }
+}
+
+// The last component of a qualified name, ignoring any "::" in template
+// arguments.
+std::string_view
+unqualified(std::string_view name)
+{
+    int depth = 0;
+    for (size_t i = name.size(); i-- > 1; ) {
+        if (name[i] == '>')
+            ++depth;
+        else if (name[i] == '<')
+            --depth;
+        else if (depth == 0 && name[i] == ':' && name[i - 1] == ':')
+            return name.substr(i + 1);
+    }
+    return name;
+}
+}
+
+void
+Info::loadNameIndex() const
+{
+    std::call_once(nameIndexOnce, [this] {
+        try {
+            const Elf::Section &namesSec = elf->getDebugSection(".debug_names", SHT_NULL);
+            if (namesSec)
+                debugNames = std::make_unique<DebugNames>(namesSec.io(), debugStrings.io());
+            const Elf::Section &gdbIndexSec = elf->getDebugSection(".gdb_index", SHT_NULL);
+            if (gdbIndexSec)
+                gdbIndex = std::make_unique<GdbIndex>(gdbIndexSec.io());
+        }
+        catch (const Exception &ex) {
+            // We can always fall back to scanning the units.
+            if (elf->context.verbose > 0)
+                *elf->context.debug << "ignoring name index for " << *elf->io << ": " << ex.what() << "\n";
+            debugNames.reset();
+            gdbIndex.reset();
+        }
+        if (debugNames || gdbIndex) {
+            haveNameIndex = true;
+            return;
+        }
+        // .debug_pubnames lists only objects and functions, and types are
+        // in .debug_pubtypes. Hash the entries of both once, so lookups
+        // don't walk the lists.
+        for (const auto *table : { &pubnames(), &pubtypes() }) {
+            for (const auto &unit : *table) {
+                haveNameIndex = true;
+                for (const auto &pubname : unit.pubnames)
+                    names[pubname.name].push_back({ unit.infoOffset, unit.infoOffset + pubname.offset });
+            }
+        }
+    });
+}
+
+bool
+Info::hasNameIndex() const
+{
+    loadNameIndex();
+    return haveNameIndex;
+}
+
+std::vector<DIE>
+Info::findDefinitions(std::string_view name) const
+{
+    loadNameIndex();
+    if (!haveNameIndex) {
+        // No index: scan all the units once, and build our own.
+        std::call_once(scanNamesOnce, [this] {
+            for (const auto &[ offset, end ] : getUnitExtents()) {
+                auto unit = getUnit(offset);
+                forEachDefinition(unit->root(), [&](const DIE &die) {
+                    if (!die.name().empty())
+                        names[die.qualifiedName()].push_back({ offset, die.getOffset() });
+                });
+            }
+        });
+    }
+
+    // .debug_pubnames, .debug_pubtypes, and .gdb_index as GCC and gdb write
+    // them have qualified names, but other producers of .debug_names and
+    // .gdb_index use the unqualified ones: look for both, and check the
+    // qualified name of what we find.
+    std::vector<IndexedName> indexed;
+    auto leaf = unqualified(name);
+    for (auto key : { name, leaf }) {
+        if (debugNames)
+            debugNames->find(key, indexed);
+        else if (gdbIndex)
+            gdbIndex->find(key, indexed);
+        else if (auto it = names.find(key); it != names.end())
+            indexed.insert(indexed.end(), it->second.begin(), it->second.end());
+        if (leaf == name || (!debugNames && !gdbIndex))
+            break;
+    }
+
+    // An index may list a name more than once, and may include declarations:
+    // we want each definition once.
+    std::vector<DIE> found;
+    std::set<Elf::Off> seen;
+    auto add = [&](const DIE &die) {
+        if (seen.insert(die.getOffset()).second)
+            found.push_back(die);
+    };
+    for (auto [ unitOffset, dieOffset ] : indexed) {
+        auto unit = getUnit(unitOffset);
+        if (dieOffset != 0) {
+            auto die = unit->offsetToDIE(DIE(), dieOffset);
+            if (die && !die.attribute(DW_AT_declaration).valid() && die.qualifiedName() == name)
+                add(die);
+        } else {
+            forEachDefinition(unit->root(), [&](const DIE &die) {
+                if (die.name() == leaf && die.qualifiedName() == name)
+                    add(die);
+            });
+        }
+    }
+    return found;
+}
+
 Unit::sptr
 Info::getUnit(Elf::Off offset) const
 {
@@ -70,56 +226,42 @@ Info::getUnit(Elf::Off offset) const
     return ent;
 }
 
+const std::vector<Info::UnitExtent> &
+Info::getUnitExtents() const
+{
+    std::call_once(unitExtentsOnce, [this] {
+        if (!debugInfo)
+            return;
+        auto size = debugInfo.io()->size();
+        DWARFReader r(debugInfo.io());
+        while (r.getOffset() < size) {
+            Elf::Off offset = r.getOffset();
+            auto [ length, dwarfLen ] = r.getlength();
+            Elf::Off end = r.getOffset() + length;
+            if (length == 0 || end > size)
+                break; // padding or garbage: no more units.
+            unitExtents.push_back({ offset, end });
+            r.setOffset(end);
+        }
+        if (elf->context.verbose > 2)
+            *elf->context.debug << "found " << unitExtents.size() << " units in "
+                << *debugInfo.io() << "\n";
+    });
+    return unitExtents;
+}
+
 DIE
 Info::offsetToDIE(Elf::Off offset) const
 {
-    // We have the offset of the DIE that we want, and the offsets of some
-    // subset of units as the keys of 'units'. We can only find the start of a
-    // unit if (a) it's the first unit, (b) we find the end of the one before
-    // it, or (c) we get a reference from somewhere else in the debug info.
-    // (eg, from aranges). So, without a hit in the aranges data, to find the
-    // Unit that contains "offset", we need to find the last unit that has an
-    // offset <= the required DIE offset, and walk forward until we find the
-    // first unit that has an end > the DIE offset (they can be the same unit)
-
-    auto it = units.upper_bound(offset);
-    // "it" is the first unit with an offset > our DIE offset. Our required
-    // Unit is before this in the sequence.
-    Elf::Off uOffset;
-
-    if (it != units.begin()) {
-        // Theres already at least one unit that has an offset < the desired DIE
-        // offset. The highest one is at it - 1. Start searching forward from there.
-        --it;
-        uOffset = it->first;
-    } else {
-        // There are either no units, or the first unit has an offset higher
-        // than our required DIE offset - start at offset 0.
-        uOffset = 0;
-    }
-
-    int i = 0;
-    for (Units::iterator start(this, uOffset), end; start != end; ++start, ++i) {
-        const auto &u = *start;
-        if (u->end > offset) {
-            // this is the first unit that ends after our required offset -
-            // we're done looking
-            if (u->offset <= offset) {
-                // the unit starts at or before our required offset - the DIE
-                // should be in here.
-                DIE entry = u->offsetToDIE(DIE(), offset);
-                if (entry) {
-                    if (elf->context.verbose > 2)
-                        *elf->context.debug << "search for DIE at " << offset
-                                  << " in " << *debugInfo.io()
-                                  << " started at " << uOffset
-                                  << ", found at " << u->offset
-                                  << " and took " << i << " iterations\n";
-                    return entry;
-                }
-            }
-            break;
-        }
+    // Find the first unit that ends after the DIE's offset: if it starts at
+    // or before the offset, then the DIE should be in there.
+    const auto &extents = getUnitExtents();
+    auto it = std::upper_bound(extents.begin(), extents.end(), offset,
+            [](Elf::Off off, const UnitExtent &extent) { return off < extent.end; });
+    if (it != extents.end() && it->offset <= offset) {
+        DIE entry = getUnit(it->offset)->offsetToDIE(DIE(), offset);
+        if (entry)
+            return entry;
     }
     throw (Exception() << "DIE not found");
 }
@@ -162,61 +304,233 @@ Info::decodeARangeSet(DWARFReader &r) const {
     while (r.getOffset() < next) {
         Elf::Addr start = r.getuint(addrlen);
         Elf::Addr length = r.getuint(addrlen);
-        (*aranges)[start + length] = std::make_pair(length, debugInfoOffset);
+        unitIndex->add(start, start + length, debugInfoOffset);
     }
 }
 
-Unit::sptr
-Info::lookupUnit(Elf::Addr addr) const {
-    if (aranges == nullptr) {
-        aranges = std::make_unique<ARanges>();
-        const Elf::Section &arangesh = elf->getDebugSection(".debug_aranges", SHT_NULL);
-        if (arangesh) {
-            DWARFReader r(arangesh.io());
-            while (!r.empty())
-                decodeARangeSet(r);
+void
+UnitIndex::add(Elf::Addr start, Elf::Addr end, Elf::Off unit)
+{
+    if (start >= end)
+        return;
+    starts.push_back(start);
+    ends.push_back(end);
+    units.push_back(unit);
+}
+
+void
+UnitIndex::sort()
+{
+    std::vector<uint32_t> order(starts.size());
+    for (uint32_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(),
+          [this](uint32_t l, uint32_t r) { return starts[l] < starts[r]; });
+    auto permute = [&order](auto &vec) {
+        std::remove_reference_t<decltype(vec)> sorted;
+        sorted.reserve(vec.size());
+        for (auto i : order)
+            sorted.push_back(vec[i]);
+        vec = std::move(sorted);
+    };
+    permute(starts);
+    permute(ends);
+    permute(units);
+    maxEnds.resize(ends.size());
+    Elf::Addr maxEnd = 0;
+    for (size_t i = 0; i < ends.size(); ++i)
+        maxEnds[i] = maxEnd = std::max(maxEnd, ends[i]);
+}
+
+std::optional<Elf::Off>
+UnitIndex::find(Elf::Addr addr) const
+{
+    // Start at the last range starting at or before addr, and work back until
+    // no earlier range can extend as far as addr.
+    auto i = size_t(std::upper_bound(starts.begin(), starts.end(), addr) - starts.begin());
+    while (i-- != 0 && maxEnds[i] > addr)
+        if (ends[i] > addr)
+            return units[i];
+    return std::nullopt;
+}
+
+namespace {
+constexpr uint32_t unitIndexMagic = 0x58494e55; // "UNIX" - unit index.
+constexpr uint32_t unitIndexVersion = 2;
+}
+
+void
+UnitIndex::save(std::ostream &os, uint64_t tag) const
+{
+    auto put = [&os](const auto &v) { os.write(reinterpret_cast<const char *>(&v), sizeof v); };
+    auto putv = [&os](const auto &vec) {
+        os.write(reinterpret_cast<const char *>(vec.data()), vec.size() * sizeof vec[0]);
+    };
+    put(unitIndexMagic);
+    put(unitIndexVersion);
+    put(tag);
+    put(uint64_t(complete));
+    put(uint64_t(size()));
+    putv(starts);
+    putv(ends);
+    putv(units);
+}
+
+bool
+UnitIndex::load(std::istream &is, uint64_t tag)
+{
+    auto get = [&is](auto &v) { return bool(is.read(reinterpret_cast<char *>(&v), sizeof v)); };
+    auto getv = [&is](auto &vec, size_t count) {
+        vec.resize(count);
+        return bool(is.read(reinterpret_cast<char *>(vec.data()), count * sizeof vec[0]));
+    };
+    uint32_t magic, version;
+    uint64_t savedTag, savedComplete, count;
+    if (!get(magic) || magic != unitIndexMagic || !get(version) || version != unitIndexVersion
+          || !get(savedTag) || savedTag != tag || !get(savedComplete) || !get(count))
+        return false;
+    if (!getv(starts, count) || !getv(ends, count) || !getv(units, count)) {
+        *this = UnitIndex{};
+        return false;
+    }
+    complete = savedComplete != 0;
+    sort();
+    return true;
+}
+
+std::filesystem::path
+Info::unitIndexCachePath() const
+{
+    const auto &dir = elf->context.options.indexCache;
+    if (dir.empty() || !debugInfo)
+        return {};
+    auto bid = elf->getBuildID();
+    if (!bid)
+        return {};
+    std::ostringstream name;
+    name << bid << ".units";
+    return dir / name.str();
+}
+
+// The index file is named for the build-id. To avoid trusting an index built
+// from a different image with the same build-id, such as one stripped or
+// rebuilt differently, tag it with the layout of the sections the index
+// depends on, and the first bytes of .debug_info.
+uint64_t
+Info::unitIndexTag() const
+{
+    uint64_t tag = 14695981039346656037ULL; // FNV-1a
+    auto mix = [&tag](const void *p, size_t len) {
+        for (size_t i = 0; i < len; ++i) {
+            tag ^= static_cast<const unsigned char *>(p)[i];
+            tag *= 1099511628211ULL;
+        }
+    };
+    const auto &abbrev = elf->getDebugSection(".debug_abbrev", SHT_NULL);
+    for (uint64_t v : { uint64_t(debugInfo.shdr.sh_offset), uint64_t(debugInfo.io()->size()),
+                        uint64_t(abbrev.io()->size()), uint64_t(debugRangelists.io()->size()),
+                        uint64_t(debugRanges.io()->size()) })
+        mix(&v, sizeof v);
+    char head[4096];
+    mix(head, debugInfo.io()->read(0, std::min(sizeof head, size_t(debugInfo.io()->size())), head));
+    return tag;
+}
+
+// Clang does not add debug_aranges. If we fail to find a unit via the
+// aranges, walk through all the units, and fold the ranges of their root
+// DIEs into the index. Decoding the root DIEs is the expensive part, and is
+// spread over --jobs threads.
+void
+Info::indexUnitRanges() const
+{
+    std::vector<Unit::sptr> all;
+    for (auto u : getUnits())
+        all.push_back(u);
+
+    std::vector<std::vector<std::pair<Elf::Addr, Elf::Addr>>> ranges(all.size());
+    size_t jobs = size_t(std::max(elf->context.options.jobs, 1));
+    forEachConcurrently(all.size(), std::min(jobs, all.size() / 32 + 1), [&](size_t i) {
+        auto root = all[i]->root();
+        auto lowpc = root.attribute(DW_AT_low_pc);
+        auto highpc = root.attribute(DW_AT_high_pc);
+        if (lowpc.valid() && highpc.valid()) {
+            auto low = uintmax_t(lowpc);
+            auto high = uintmax_t(highpc);
+            if (highpc.form() != DW_FORM_addr)
+                high += low;
+            ranges[i].emplace_back(low, high);
         }
+        // do we have ranges for this DIE?
+        const auto &dieRanges = root.getRanges();
+        if (dieRanges != nullptr)
+            for (auto r : *dieRanges)
+                ranges[i].emplace_back(r.first, r.second);
+    });
+    for (size_t i = 0; i < all.size(); ++i)
+        for (auto [low, high] : ranges[i])
+            unitIndex->add(low, high, all[i]->offset);
+    unitIndex->complete = true;
+    unitIndex->sort();
+
+    auto cachePath = unitIndexCachePath();
+    if (!cachePath.empty()) {
+        // Write to a temporary, and rename, so readers never see a partial index.
+        auto tag = unitIndexTag();
+        auto tmpPath = cachePath;
+        tmpPath += "." + std::to_string(getpid());
+        std::ofstream os(tmpPath, std::ios::binary | std::ios::trunc);
+        unitIndex->save(os, tag);
+        os.close();
+        std::error_code ec;
+        if (os)
+            std::filesystem::rename(tmpPath, cachePath, ec);
+        else
+            std::filesystem::remove(tmpPath, ec);
+        if (ec && elf->context.verbose)
+            *elf->context.debug << "failed to save unit index to " << cachePath << ": " << ec.message() << "\n";
     }
-    auto it = aranges->upper_bound(addr);
-    if (it != aranges->end() && it->first - it->second.first <= addr)
-        return getUnit(it->second.second);
-
-    if (!unitRangesCached) {
-        // Clang does not add debug_aranges.  If we fail to find the unit via
-        // the aranges, walk through all the units, and check out their
-        // DW_AT_range attribute, and fold its content into the aranges data.
-        unitRangesCached = true;
-        for (auto u : getUnits()) {
-            auto root = u->root();
-            auto lowpc = root.attribute(DW_AT_low_pc);
-            auto highpc = root.attribute(DW_AT_high_pc);
-            if (lowpc.valid() && highpc.valid()) {
-               auto low = uintmax_t(lowpc);
-               auto high = uintmax_t(highpc);
-               if (highpc.form() != DW_FORM_addr)
-                  high += low;
-               (*aranges)[high] = std::make_pair(high - low, u->offset);
+}
+
+Unit::sptr
+Info::lookupUnit(Elf::Addr addr) const {
+    std::optional<Elf::Off> unit;
+    {
+        std::lock_guard guard(unitIndexLock);
+        if (unitIndex == nullptr) {
+            unitIndex = std::make_unique<UnitIndex>();
+            auto cachePath = unitIndexCachePath();
+            std::ifstream is;
+            if (!cachePath.empty())
+                is.open(cachePath, std::ios::binary);
+            if (is.is_open() && unitIndex->load(is, unitIndexTag())) {
+                if (elf->context.verbose)
+                    *elf->context.debug << "loaded unit index from " << cachePath << "\n";
+            } else {
+                const Elf::Section &arangesh = elf->getDebugSection(".debug_aranges", SHT_NULL);
+                if (arangesh) {
+                    DWARFReader r(arangesh.io());
+                    while (!r.empty())
+                        decodeARangeSet(r);
+                }
+                unitIndex->sort();
             }
-            // do we have ranges for this DIE?
-            const auto &ranges = root.getRanges();
-            if (ranges != nullptr)
-                for (auto r : *ranges)
-                    (*aranges)[r.second] = { r.first, u->offset };
+        }
+        unit = unitIndex->find(addr);
+        if (!unit && !unitIndex->complete) {
+            // Try again once we've added all the unit ranges.
+            indexUnitRanges();
+            unit = unitIndex->find(addr);
         }
     }
-
-    // Try again now we've added all the unit ranges.
-    it = aranges->upper_bound(addr);
-    if (it != aranges->end() && it->first - it->second.first <= addr)
-        return getUnit(it->second.second);
-    return nullptr;
+    return unit ? getUnit(*unit) : nullptr;
 }
 
-Abbreviation::Abbreviation(DWARFReader &r)
+Abbreviation::Abbreviation(DWARFReader &r, const Unit &unit)
     : tag(Tag(r.getuleb128()))
     , hasChildren(HasChildren(r.getu8()) == DW_CHILDREN_yes)
-    , sorted(false)
     , nextSibIdx(-1)
+    , fixedSize(0)
+    , siblingOffset(-1)
 {
     forms.reserve(4);
     attrName2Idx.reserve(4);
@@ -225,12 +539,20 @@ Abbreviation::Abbreviation(DWARFReader &r)
         auto form = Form(r.getuleb128());
         if (name == 0 && form == 0)
             break;
-        if (name == DW_AT_sibling)
+        int size = unit.formSize(form);
+        if (name == DW_AT_sibling) {
             nextSibIdx = int(i);
+            bool unitRelative = form == DW_FORM_ref1 || form == DW_FORM_ref2
+                || form == DW_FORM_ref4 || form == DW_FORM_ref8;
+            if (fixedSize >= 0 && unitRelative)
+                siblingOffset = fixedSize;
+        }
+        fixedSize = fixedSize >= 0 && size >= 0 ? fixedSize + size : -1;
         intmax_t value = (form == DW_FORM_implicit_const) ? r.getsleb128() : 0;
         forms.emplace_back(form, value);
         attrName2Idx.emplace_back(name, i);
     }
+    std::sort(attrName2Idx.begin(), attrName2Idx.end());
     attrName2Idx.shrink_to_fit();
     forms.shrink_to_fit();
 }
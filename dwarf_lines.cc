@@ -1,4 +1,6 @@
 #include "libpstack/dwarf.h"
+#include <algorithm>
+#include <limits>
 namespace pstack::Dwarf {
 
 namespace {
@@ -232,6 +234,62 @@ LineInfo::build(DWARFReader &r, Unit &unit)
             }
         }
     }
+    table = LineTable(matrix, files);
+}
+
+LineTable::LineTable(const std::vector<LineState> &matrix, const std::vector<FileEntry> &fileEntries)
+{
+    size_t seqStart = 0;
+    for (size_t i = 0; i < matrix.size(); ++i) {
+        if (!matrix[i].end_sequence)
+            continue;
+        Elf::Addr start = matrix[seqStart].addr;
+        Elf::Addr end = matrix[i].addr;
+        // Skip empty sequences, and any too large for our 32-bit offsets.
+        if (start < end && end - start <= std::numeric_limits<uint32_t>::max()) {
+            sequences.push_back({ start, end, end, uint32_t(sequences.size()),
+                    uint32_t(addrOffsets.size()), uint32_t(i + 1 - seqStart) });
+            for (size_t row = seqStart; row <= i; ++row) {
+                addrOffsets.push_back(uint32_t(matrix[row].addr - start));
+                files.push_back(uint32_t(matrix[row].file - fileEntries.data()));
+                lines.push_back(matrix[row].line);
+            }
+        }
+        seqStart = i + 1;
+    }
+    std::sort(sequences.begin(), sequences.end(),
+          [](const Sequence &l, const Sequence &r) { return l.start < r.start; });
+    Elf::Addr maxEnd = 0;
+    for (auto &seq : sequences)
+        seq.maxEnd = maxEnd = std::max(maxEnd, seq.end);
+}
+
+std::optional<LineTable::Row>
+LineTable::find(Elf::Addr addr) const
+{
+    // Find the sequence containing addr. Sequences can overlap (eg, for code
+    // discarded by the linker), in which case prefer the earliest in the
+    // matrix.
+    auto seqIt = std::upper_bound(sequences.begin(), sequences.end(), addr,
+          [](Elf::Addr a, const Sequence &seq) { return a < seq.start; });
+    const Sequence *found = nullptr;
+    while (seqIt != sequences.begin()) {
+        --seqIt;
+        if (seqIt->maxEnd <= addr)
+            break;
+        if (seqIt->end > addr && (found == nullptr || seqIt->order < found->order))
+            found = &*seqIt;
+    }
+    if (found == nullptr)
+        return std::nullopt;
+
+    // The row covering addr is the last one at or before it. The final
+    // (end_sequence) row is beyond addr, so is never chosen.
+    auto offset = uint32_t(addr - found->start);
+    auto rowsBegin = addrOffsets.begin() + found->firstRow;
+    auto rowsEnd = rowsBegin + found->rowCount;
+    size_t row = std::upper_bound(rowsBegin, rowsEnd, offset) - addrOffsets.begin() - 1;
+    return Row{ files[row], lines[row] };
 }
 
 FileEntry::FileEntry(std::string name_, unsigned dirindex_, unsigned lastMod_, unsigned length_)
@@ -0,0 +1,206 @@
+#include "libpstack/dwarf.h"
+
+#include <cctype>
+
+namespace pstack::Dwarf {
+
+namespace {
+
+// The hash function for .debug_names is the DJB hash of the case-folded name.
+uint32_t
+debugNamesHash(std::string_view name)
+{
+    uint32_t hash = 5381;
+    for (unsigned char c : name)
+        hash = hash * 33 + uint32_t(std::tolower(c));
+    return hash;
+}
+
+// The hash function for .gdb_index. Versions from 5 on fold the case of the
+// name.
+uint32_t
+gdbIndexHash(uint32_t version, std::string_view name)
+{
+    uint32_t hash = 0;
+    for (unsigned char c : name)
+        hash = hash * 67 + uint32_t(version >= 5 ? std::tolower(c) : c) - 113;
+    return hash;
+}
+
+}
+
+DebugNames::DebugNames(Reader::csptr io_, Reader::csptr strings_)
+    : io(std::move(io_))
+    , strings(std::move(strings_))
+{
+    DWARFReader r(io);
+    while (!r.empty()) {
+        auto [ length, dwarfLen ] = r.getlength();
+        if (length == 0)
+            break;
+        Elf::Off next = r.getOffset() + length;
+        auto version = r.getu16();
+        if (version != 5)
+            throw (Exception() << "unsupported .debug_names version " << version);
+        r.getu16(); // padding
+        Table &table = tables.emplace_back();
+        table.dwarfLen = unsigned(dwarfLen);
+        uint32_t compUnitCount = r.getu32();
+        uint32_t localTypeUnitCount = r.getu32();
+        uint32_t foreignTypeUnitCount = r.getu32();
+        table.bucketCount = r.getu32();
+        table.nameCount = r.getu32();
+        uint32_t abbrevTableSize = r.getu32();
+        uint32_t augmentationSize = r.getu32();
+        r.skip((augmentationSize + 3) & ~3U);
+
+        table.units.reserve(compUnitCount);
+        for (uint32_t i = 0; i < compUnitCount; ++i)
+            table.units.push_back(r.getuint(dwarfLen));
+        r.skip(localTypeUnitCount * dwarfLen + foreignTypeUnitCount * 8);
+
+        table.buckets = r.getOffset();
+        table.hashes = table.buckets + table.bucketCount * 4;
+        table.stringOffsets = table.hashes + (table.bucketCount ? table.nameCount * 4 : 0);
+        table.entryOffsets = table.stringOffsets + table.nameCount * dwarfLen;
+        Elf::Off abbrevs = table.entryOffsets + table.nameCount * dwarfLen;
+        table.entryPool = abbrevs + abbrevTableSize;
+
+        r.setOffset(abbrevs);
+        for (;;) {
+            uintmax_t code = r.getuleb128();
+            if (code == 0)
+                break;
+            Abbrev &abbrev = table.abbrevs[code];
+            abbrev.tag = Tag(r.getuleb128());
+            for (;;) {
+                auto idx = IndexAttr(r.getuleb128());
+                auto form = Form(r.getuleb128());
+                if (idx == 0 && form == 0)
+                    break;
+                abbrev.attrs.emplace_back(idx, form);
+            }
+        }
+        r.setOffset(next);
+    }
+}
+
+void
+DebugNames::findEntries(const Table &table, uint32_t idx, std::vector<IndexedName> &found) const
+{
+    DWARFReader r(io, table.entryOffsets + idx * table.dwarfLen);
+    r.setOffset(table.entryPool + r.getuint(table.dwarfLen));
+    for (;;) {
+        uintmax_t code = r.getuleb128();
+        if (code == 0)
+            break;
+        auto it = table.abbrevs.find(code);
+        if (it == table.abbrevs.end())
+            throw (Exception() << "no abbreviation " << code << " in .debug_names");
+        // Without a DW_IDX_compile_unit, an index of one unit refers to it.
+        uintmax_t unit = 0;
+        uintmax_t die = 0;
+        bool typeUnit = false;
+        for (auto [ idx, form ] : it->second.attrs) {
+            uintmax_t value = r.readFormUnsigned(form);
+            switch (idx) {
+                case DW_IDX_compile_unit: unit = value; break;
+                case DW_IDX_type_unit: typeUnit = true; break;
+                case DW_IDX_die_offset: die = value; break;
+                default: break;
+            }
+        }
+        if (!typeUnit && unit < table.units.size())
+            found.push_back({ table.units[unit], table.units[unit] + die });
+    }
+}
+
+void
+DebugNames::find(std::string_view name, std::vector<IndexedName> &found) const
+{
+    uint32_t hash = debugNamesHash(name);
+    for (const auto &table : tables) {
+        auto nameMatches = [&](uint32_t idx) {
+            DWARFReader r(io, table.stringOffsets + idx * table.dwarfLen);
+            return strings->stringEquals(r.getuint(table.dwarfLen), name);
+        };
+        if (table.bucketCount == 0) {
+            // The table has no hash table: just search the names.
+            for (uint32_t i = 0; i < table.nameCount; ++i)
+                if (nameMatches(i))
+                    findEntries(table, i, found);
+            continue;
+        }
+        uint32_t bucket = hash % table.bucketCount;
+        auto first = io->readObj<uint32_t>(table.buckets + bucket * 4);
+        if (first == 0)
+            continue;
+        // Names in a bucket are consecutive, and the index is 1-based.
+        for (uint32_t i = first - 1; i < table.nameCount; ++i) {
+            auto entryHash = io->readObj<uint32_t>(table.hashes + i * 4);
+            if (entryHash % table.bucketCount != bucket)
+                break;
+            if (entryHash == hash && nameMatches(i))
+                findEntries(table, i, found);
+        }
+    }
+}
+
+GdbIndex::GdbIndex(Reader::csptr io_)
+    : io(std::move(io_))
+{
+    DWARFReader r(io);
+    version = r.getu32();
+    if (version < 5 || version > 8)
+        throw (Exception() << "unsupported .gdb_index version " << version);
+    Elf::Off cuList = r.getu32();
+    Elf::Off typesList = r.getu32();
+    r.getu32(); // address area
+    symbolTable = r.getu32();
+    constantPool = r.getu32();
+    symbolSlots = uint32_t((constantPool - symbolTable) / 8);
+    if ((symbolSlots & (symbolSlots - 1)) != 0)
+        throw (Exception() << ".gdb_index symbol table size " << symbolSlots
+              << " is not a power of two");
+
+    // The CU list is pairs of 64-bit offset and length.
+    r.setOffset(cuList);
+    units.reserve((typesList - cuList) / 16);
+    while (r.getOffset() < typesList) {
+        units.push_back(r.getuint(8));
+        r.skip(8);
+    }
+}
+
+void
+GdbIndex::find(std::string_view name, std::vector<IndexedName> &found) const
+{
+    if (symbolSlots == 0)
+        return;
+    uint32_t hash = gdbIndexHash(version, name);
+    uint32_t mask = symbolSlots - 1;
+    uint32_t step = ((hash * 17) & mask) | 1;
+    for (uint32_t slot = hash & mask, probes = 0; probes < symbolSlots; slot = (slot + step) & mask, ++probes) {
+        DWARFReader r(io, symbolTable + slot * 8);
+        uint32_t nameOff = r.getu32();
+        uint32_t vecOff = r.getu32();
+        if (nameOff == 0 && vecOff == 0)
+            return;
+        if (!io->stringEquals(constantPool + nameOff, name))
+            continue;
+
+        // The CU vector holds a count, and then an entry for each CU. The
+        // low 24 bits of each are the CU's index, with type units following
+        // the compile units.
+        r.setOffset(constantPool + vecOff);
+        uint32_t count = r.getu32();
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t unit = r.getu32() & 0xffffff;
+            if (unit < units.size())
+                found.push_back({ units[unit], 0 });
+        }
+        return;
+    }
+}
+
+}
@@ -49,13 +49,24 @@ DWARFReader::readFormUnsigned(Form form)
 {
     switch (form) {
         case DW_FORM_udata:
+        case DW_FORM_ref_udata:
             return getuleb128();
         case DW_FORM_data1:
+        case DW_FORM_ref1:
+        case DW_FORM_flag:
             return getu8();
         case DW_FORM_data2:
+        case DW_FORM_ref2:
             return getu16();
         case DW_FORM_data4:
+        case DW_FORM_ref4:
             return getu32();
+        case DW_FORM_data8:
+        case DW_FORM_ref8:
+        case DW_FORM_ref_sig8:
+            return getuint(8);
+        case DW_FORM_flag_present:
+            return 1;
         default:
             throw (Exception() << "unhandled form " << form << " when reading unsigned");
     }
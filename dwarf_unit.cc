@@ -9,10 +9,22 @@ Unit::load()
     auto &abbrev { dwarf->elf->getDebugSection(".debug_abbrev", SHT_NULL) };
     DWARFReader abbR(abbrev.io(), abbrevOffset);
     uintmax_t code;
-    while ((code = abbR.getuleb128()) != 0)
-        abbreviations.emplace(std::piecewise_construct,
-                std::forward_as_tuple(code),
-                std::forward_as_tuple(abbR));
+    std::vector<uintmax_t> codes;
+    while ((code = abbR.getuleb128()) != 0) {
+        codes.push_back(code);
+        abbreviations.emplace_back(abbR, *this);
+    }
+    auto maxCode = codes.empty() ? 0 : *std::max_element(codes.begin(), codes.end());
+    bool dense = maxCode <= 4 * codes.size() + 64;
+    if (dense)
+        abbrevByCode.resize(maxCode + 1);
+    for (uint32_t i = 0; i < codes.size(); ++i) {
+        // If a code is defined twice, the first definition wins.
+        if (!dense)
+            sparseAbbrevs.emplace(codes[i], i + 1);
+        else if (abbrevByCode[codes[i]] == 0)
+            abbrevByCode[codes[i]] = i + 1;
+    }
 }
 
 std::string
@@ -137,13 +149,19 @@ Unit::offsetToRawDIE(const DIE &parent, Elf::Off offset) {
     if (offset == 0 || offset < this->offset || offset >= this->end)
         return nullptr;
 
-    auto &rawptr = allEntries[offset];
-    if (rawptr == nullptr) {
-        rawptr = DIE::decode(this, parent, offset);
-        // this may still be null, and occupy space in the hash table, but
-        // it's harmless, and cheaper than removing the entry.
+    if (arena == nullptr)
+        arena = std::make_shared<DIEArena>();
+    DIE::Raw *raw;
+    if (auto slot = arena->find(offset); slot != nullptr) {
+        raw = *slot;
+    } else {
+        raw = DIE::decode(this, *arena, parent, offset);
+        // this may be null, and occupy space in the index, but it's
+        // harmless, and saves decoding it again.
+        arena->insert(offset, raw);
     }
-    return rawptr;
+    // The DIE shares ownership of the whole arena.
+    return raw == nullptr ? nullptr : std::shared_ptr<DIE::Raw>(arena, raw);
 }
 
 /*
@@ -154,6 +172,7 @@ Unit::offsetToRawDIE(const DIE &parent, Elf::Off offset) {
  */
 DIE
 Unit::offsetToDIE(const DIE &parent, Elf::Off offset) {
+    std::lock_guard guard(entriesLock);
     if (abbreviations.empty())
         load();
     return {shared_from_this(), offset, offsetToRawDIE(parent, offset)};
@@ -192,15 +211,12 @@ Unit::sourceFromAddr(Elf::Addr addr, std::vector<std::pair<std::string, int>> &i
         return false;
     const auto &lines = getLines();
     if (lines != nullptr) {
-        for (auto i = lines->matrix.begin(); i != lines->matrix.end(); ++i) {
-            if (i->end_sequence)
-                continue;
-            auto next = i+1;
-            if (i->addr <= addr && next->addr > addr) {
-                const std::string &dirname = lines->directories[i->file->dirindex];
-                info.emplace_back(dwarf->elf->context.verbose != 0 ? dirname + "/" + i->file->name : i->file->name, i->line);
-                return true;
-            }
+        auto row = lines->table.find(addr);
+        if (row) {
+            const FileEntry &file = lines->files[row->file];
+            const std::string &dirname = lines->directories[file.dirindex];
+            info.emplace_back(dwarf->elf->context.verbose != 0 ? dirname + "/" + file.name : file.name, row->line);
+            return true;
         }
     }
     return false;
@@ -227,8 +243,117 @@ Unit::getLines()
 const Abbreviation *
 Unit::findAbbreviation(size_t code) const
 {
-    auto it = abbreviations.find(code);
-    return it != abbreviations.end() ? &it->second : nullptr;
+    uint32_t idx;
+    if (code < abbrevByCode.size()) {
+        idx = abbrevByCode[code];
+    } else {
+        auto it = sparseAbbrevs.find(code);
+        idx = it != sparseAbbrevs.end() ? it->second : 0;
+    }
+    return idx != 0 ? &abbreviations[idx - 1] : nullptr;
+}
+
+int
+Unit::formSize(Form form) const
+{
+    switch (form) {
+    case DW_FORM_flag_present:
+    case DW_FORM_implicit_const:
+        return 0;
+    case DW_FORM_data1: case DW_FORM_ref1: case DW_FORM_flag:
+    case DW_FORM_strx1: case DW_FORM_addrx1:
+        return 1;
+    case DW_FORM_data2: case DW_FORM_ref2: case DW_FORM_strx2: case DW_FORM_addrx2:
+        return 2;
+    case DW_FORM_strx3: case DW_FORM_addrx3:
+        return 3;
+    case DW_FORM_data4: case DW_FORM_ref4: case DW_FORM_strx4: case DW_FORM_addrx4:
+        return 4;
+    case DW_FORM_data8: case DW_FORM_ref8: case DW_FORM_ref_sig8:
+        return 8;
+    case DW_FORM_addr:
+        return addrlen;
+    case DW_FORM_strp:
+    case DW_FORM_line_strp:
+        return version <= 2 ? 4 : int(dwarfLen);
+    case DW_FORM_GNU_strp_alt:
+    case DW_FORM_GNU_ref_alt:
+    case DW_FORM_ref_addr:
+    case DW_FORM_sec_offset:
+        return int(dwarfLen);
+    default:
+        return -1;
+    }
+}
+
+void
+Unit::skipForm(DWARFReader &r, Form form) const
+{
+    if (int size = formSize(form); size >= 0) {
+        r.skip(size);
+        return;
+    }
+    switch (form) {
+    case DW_FORM_sdata:
+    case DW_FORM_udata:
+    case DW_FORM_GNU_str_index:
+    case DW_FORM_GNU_addr_index:
+    case DW_FORM_strx:
+    case DW_FORM_loclistx:
+    case DW_FORM_rnglistx:
+    case DW_FORM_addrx:
+    case DW_FORM_ref_udata:
+        r.getuleb128();
+        break;
+    case DW_FORM_string:
+        r.getstring();
+        break;
+    case DW_FORM_block1:
+        r.skip(r.getu8());
+        break;
+    case DW_FORM_block2:
+        r.skip(r.getu16());
+        break;
+    case DW_FORM_block4:
+        r.skip(r.getu32());
+        break;
+    case DW_FORM_exprloc:
+    case DW_FORM_block:
+        r.skip(r.getuleb128());
+        break;
+    default:
+        throw (Exception() << "unhandled form " << form << " skipping DIE");
+    }
+}
+
+Elf::Off
+Unit::skipEntries(Elf::Off entry) const
+{
+    DWARFReader r(dwarf->debugInfo.io(), entry, end);
+    for (;;) {
+        size_t code = r.getuleb128();
+        if (code == 0)
+            return r.getOffset();
+        const Abbreviation *abbr = findAbbreviation(code);
+        if (abbr == nullptr)
+            throw (Exception() << "no abbreviation " << code << " for DIE at " << entry);
+        Elf::Off attrs = r.getOffset();
+        if (abbr->hasChildren && abbr->siblingOffset >= 0) {
+            // Jump straight to the sibling.
+            r.setOffset(attrs + abbr->siblingOffset);
+            auto sibling = r.getuint(formSize(abbr->forms[abbr->nextSibIdx].form));
+            r.setOffset(offset + sibling);
+            continue;
+        }
+        if (abbr->fixedSize >= 0) {
+            r.skip(abbr->fixedSize);
+        } else {
+            for (const auto &form : abbr->forms)
+                skipForm(r, form.form);
+        }
+        if (abbr->hasChildren)
+            r.setOffset(skipEntries(r.getOffset()));
+    }
 }
 
 const std::unique_ptr<Ranges> &
@@ -248,7 +373,8 @@ Unit::getRanges(const DIE &die, uintmax_t base) {
 void
 Unit::purge()
 {
-    allEntries = AllEntries();
+    std::lock_guard guard(entriesLock);
+    arena.reset();
     rangesForOffset = decltype(rangesForOffset)();
     macros.reset(nullptr);
 }
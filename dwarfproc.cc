@@ -12,12 +12,19 @@ namespace pstack::Procman {
 struct RegisterFromReader {
    const Reader &reader;
    off_t offset;
+   std::span<const char> prefetched; // content at offset, if we've already read it.
 public:
-   explicit RegisterFromReader(const Reader &reader, off_t offset) : reader(reader), offset(offset) { }
+   explicit RegisterFromReader(const Reader &reader, off_t offset, std::span<const char> prefetched = {})
+      : reader(reader), offset(offset), prefetched(prefetched) { }
 };
 
 template <typename T>
 auto get( const RegisterFromReader &rfr ) -> T {
+   if (rfr.prefetched.size() >= sizeof (T)) {
+      T t;
+      memcpy((void *)&t, rfr.prefetched.data(), sizeof t);
+      return t;
+   }
    T t = rfr.reader.readObj<T>(rfr.offset);
    return t;
 }
@@ -503,6 +510,149 @@ ExpressionStack::eval(Process &proc, Dwarf::DWARFReader &r, const StackFrame *fr
 }
 
 
+namespace {
+
+// Classify a row of an unwind table, creating a plan that can be applied
+// without the generic unwinder, if the row's shape allows it.
+template <typename Arch>
+UnwindPlan
+makePlan(const Dwarf::UnwindTable &table, const Dwarf::UnwindRow &row, int rar)
+{
+    using namespace Dwarf;
+    UnwindPlan plan;
+    user_regs_struct probe{};
+
+    if (row.cfaValue.type != OFFSET || row.cfaValue.u.offset != int32_t(row.cfaValue.u.offset))
+        return plan;
+    if (row.cfaReg != Arch::SP && row.cfaReg != Arch::FP)
+        return plan;
+
+    for (const auto &[regno, unwind] : table.rules(row)) {
+        switch (unwind.type) {
+            case SAME:
+            case ARCH:
+                continue; // the register's value is unchanged.
+            case UNDEF:
+                if (regno == rar)
+                    return {}; // end of the stack: let the generic code report it.
+                continue;
+            case OFFSET:
+                if (Arch::gpr(probe, regno) == nullptr
+                        || unwind.u.offset != int32_t(unwind.u.offset)
+                        || plan.savedCount == UnwindPlan::MAXSAVED)
+                    return {};
+                plan.saved[plan.savedCount++] = { uint8_t(regno), int32_t(unwind.u.offset) };
+                continue;
+            default:
+                return {};
+        }
+    }
+    if (Arch::gpr(probe, rar) == nullptr)
+        return {};
+    plan.kind = row.cfaReg == Arch::SP ? UnwindPlan::CFA_SP : UnwindPlan::CFA_FP;
+    plan.cfaOffset = int32_t(row.cfaValue.u.offset);
+    return plan;
+}
+
+// Find the plans for the FDE covering a process address. Call with
+// unwindPlanLock held. Entries are never removed, so the result remains
+// valid after the lock is released.
+const UnwindPlans *
+findPlans(Process &p, Elf::Addr addr)
+{
+    auto it = p.unwindPlans.upper_bound(addr);
+    if (it == p.unwindPlans.begin())
+        return nullptr;
+    --it;
+    return addr < it->second.end ? &it->second : nullptr;
+}
+
+// Create plans for an FDE the generic unwinder has used, so subsequent
+// unwinds through the same function can avoid it.
+void
+recordPlans(Process &p, const ProcessLocation &location, const Dwarf::FDE &fde,
+      const Dwarf::UnwindTable &table)
+{
+    Elf::Addr start = fde.iloc + location.elfReloc();
+    {
+        std::shared_lock guard(p.unwindPlanLock);
+        if (p.unwindPlans.find(start) != p.unwindPlans.end())
+            return;
+    }
+    UnwindPlans plans { start + fde.irange, location.elfReloc(), location.dwarf(),
+        &table, fde.cie.rar, fde.cie.isSignalHandler, {} };
+    plans.plans.reserve(table.getRows().size());
+    for (const auto &row : table.getRows())
+        plans.plans.push_back(makePlan<UnwindArch>(table, row, plans.rar));
+    std::unique_lock guard(p.unwindPlanLock);
+    p.unwindPlans.emplace(start, std::move(plans));
+}
+
+// Unwind a frame using a precomputed plan. Returns nullopt if there is no
+// plan for the frame, or it can't be applied, in which case the caller should
+// fall back to the generic unwinder.
+template <typename Arch>
+std::optional<CoreRegisters>
+unwindWithPlan(StackFrame &frame, Process &p)
+{
+    static const bool disabled = getenv("NO_FAST_UNWIND") != nullptr;
+    if (disabled)
+        return std::nullopt;
+
+    // Find the same location as StackFrame::scopeIP would.
+    auto pc = Elf::Addr(frame.rawIP());
+    if (pc == 0)
+        return std::nullopt;
+    bool exact = frame.mechanism == UnwindMechanism::MACHINEREGS
+        || frame.mechanism == UnwindMechanism::TRAMPOLINE
+        || frame.isSignalTrampoline || frame.unwoundFromTrampoline;
+
+    const UnwindPlans *plans;
+    const Dwarf::UnwindRow *row;
+    {
+        std::shared_lock guard(p.unwindPlanLock);
+        plans = findPlans(p, pc);
+        if (!exact) {
+            if (plans == nullptr || plans->isSignalHandler)
+                return std::nullopt;
+            plans = findPlans(p, --pc);
+        }
+        if (plans == nullptr || plans->isSignalHandler)
+            return std::nullopt;
+        row = plans->table->rowForAddr(pc - plans->elfReloc);
+    }
+    if (row == nullptr)
+        return std::nullopt;
+    const UnwindPlan &plan = plans->plans[row - plans->table->getRows().data()];
+    if (plan.kind == UnwindPlan::GENERIC)
+        return std::nullopt;
+
+    gpreg cfa = *Arch::gpr(frame.regs.user, plan.kind == UnwindPlan::CFA_SP ? Arch::SP : Arch::FP)
+        + plan.cfaOffset;
+    if (cfa == 0)
+        return std::nullopt;
+
+    std::array<gpreg, UnwindPlan::MAXSAVED> values;
+    std::array<Reader::Segment, UnwindPlan::MAXSAVED> segments;
+    for (size_t i = 0; i < plan.savedCount; ++i)
+        segments[i] = { cfa + plan.saved[i].second, sizeof (gpreg), (char *)&values[i], 0 };
+    p.io->readv(std::span(segments.data(), plan.savedCount));
+    for (size_t i = 0; i < plan.savedCount; ++i)
+        if (segments[i].rc != sizeof (gpreg))
+            return std::nullopt; // let the generic unwinder deal with unreadable stacks.
+
+    CoreRegisters out = frame.regs;
+    *Arch::gpr(out.user, Arch::SP) = cfa;
+    for (size_t i = 0; i < plan.savedCount; ++i)
+        *Arch::gpr(out.user, plan.saved[i].first) = values[i];
+    if (plans->rar != IPREG)
+        *Arch::gpr(out.user, IPREG) = *Arch::gpr(out.user, plans->rar);
+    frame.cfa = cfa;
+    return out;
+}
+
+}
+
 StackFrame::StackFrame(UnwindMechanism mechanism, const CoreRegisters &regs_)
     : regs(regs_)
     , cfa(0)
@@ -511,6 +661,9 @@ StackFrame::StackFrame(UnwindMechanism mechanism, const CoreRegisters &regs_)
 }
 
 std::optional<CoreRegisters> StackFrame::unwind(Process &p) {
+    if (auto planned = unwindWithPlan<UnwindArch>(*this, p))
+        return planned;
+
     ProcessLocation location = scopeIP(p);
 
     const Dwarf::CFI *cfi = location.cfi();
@@ -530,35 +683,34 @@ std::optional<CoreRegisters> StackFrame::unwind(Process &p) {
 
     DWARFReader r(cfi->io, fde->instructions, fde->end);
 
-    auto iter = location.dwarf()->callFrameForAddr.find(objaddr);
-    if (iter == location.dwarf()->callFrameForAddr.end()) {
-        location.dwarf()->callFrameForAddr[objaddr] = fde->execInsns(objaddr);
-    }
-
-    const CallFrame &dcf = location.dwarf()->callFrameForAddr[objaddr];
+    const UnwindTable &table = fde->unwindTable();
+    const UnwindRow *dcf = table.rowForAddr(objaddr);
+    if (dcf == nullptr)
+        throw (Exception() << "no unwind row for instruction address " << std::hex << location.location());
+    recordPlans(p, location, *fde, table);
 
     // Given the registers available, and the state of the call unwind data,
     // calculate the CFA at this point.
     CoreRegisters out;
-    switch (dcf.cfaValue.type) {
+    switch (dcf->cfaValue.type) {
         case SAME:
         case UNDEF:
         case ARCH:
-            cfa = std::get<gpreg>(regs.getDwarf(dcf.cfaReg));
+            cfa = std::get<gpreg>(regs.getDwarf(dcf->cfaReg));
             break;
         case VAL_OFFSET:
         case VAL_EXPRESSION:
         case REG:
-            throw (Exception() << "unhandled CFA value type " << dcf.cfaValue.type);
+            throw (Exception() << "unhandled CFA value type " << dcf->cfaValue.type);
 
         case OFFSET:
-            cfa = std::get<gpreg>(regs.getDwarf(dcf.cfaReg)) + dcf.cfaValue.u.offset;
+            cfa = std::get<gpreg>(regs.getDwarf(dcf->cfaReg)) + dcf->cfaValue.u.offset;
             break;
 
         case EXPRESSION: {
             ExpressionStack stack;
-            auto start = dcf.cfaValue.u.expression.offset;
-            auto end = start + dcf.cfaValue.u.expression.length;
+            auto start = dcf->cfaValue.u.expression.offset;
+            auto end = start + dcf->cfaValue.u.expression.length;
             DWARFReader r(location.cfi()->io, start, end);
             cfa = stack.eval(p, r, this, location.elfReloc());
             break;
@@ -567,7 +719,7 @@ std::optional<CoreRegisters> StackFrame::unwind(Process &p) {
             cfa = -1;
             break;
     }
-    auto rarInfo = dcf.registers.find(cie->rar);
+    const RegisterUnwind *rarInfo = table.findRule(*dcf, cie->rar);
 
 
     out = regs;
@@ -575,11 +727,28 @@ std::optional<CoreRegisters> StackFrame::unwind(Process &p) {
     // "The CFA is defined to be the stack pointer in the calling frame."
     out.setDwarf(CFA_RESTORE_REGNO, RegisterValue{cfa} );
 #endif
-    for (const auto &[regno, unwind] : dcf.registers) {
+
+    // Registers saved relative to the CFA are usually spread over a few
+    // words of the stack: fetch them all with one batched read. We don't know
+    // the size of each register yet, so read enough for the largest.
+    std::vector<std::array<char, sizeof (Simd128)>> saved;
+    std::vector<Reader::Segment> savedSegments;
+    saved.reserve(dcf->ruleCount);
+    for (const auto &[regno, unwind] : table.rules(*dcf)) {
+        if (unwind.type == OFFSET) {
+            saved.emplace_back();
+            savedSegments.push_back({ cfa + unwind.u.offset, saved.back().size(), saved.back().data(), 0 });
+        }
+    }
+    p.io->readv(savedSegments);
+
+    size_t savedIdx = 0;
+    for (const auto &[regno, unwind] : table.rules(*dcf)) {
         try {
            switch (unwind.type) {
                case OFFSET: {
-                   RegisterFromReader rfr(*p.io, cfa + unwind.u.offset);
+                   const auto &seg = savedSegments[savedIdx++];
+                   RegisterFromReader rfr(*p.io, cfa + unwind.u.offset, { seg.ptr, seg.rc });
                    out.setDwarf(regno, rfr);
                    break;
                }
@@ -621,12 +790,12 @@ std::optional<CoreRegisters> StackFrame::unwind(Process &p) {
     }
 
     // If the return address isn't defined, then we can't unwind.
-    if ((rarInfo != dcf.registers.end() && rarInfo->second.type == UNDEF) || cfa == 0) {
+    if ((rarInfo != nullptr && rarInfo->type == UNDEF) || cfa == 0) {
         if (p.context.verbose > 1) {
            *p.context.debug << "DWARF unwinding stopped at "
               << std::hex << location.location() << std::dec
               << ": " <<
-              (rarInfo == dcf.registers.end() ? "RAR register undefined"
+              (rarInfo == nullptr ? "RAR register undefined"
                : "null CFA for frame")
               << std::endl;
         }
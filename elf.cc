@@ -3,6 +3,7 @@
 #include "libpstack/ioflag.h"
 #include "libpstack/inflatereader.h"
 #include "libpstack/lzmareader.h"
+#include "libpstack/zstdreader.h"
 
 #include <algorithm>
 #include <filesystem>
@@ -23,7 +24,7 @@ namespace {
  * Culled from System V Application Binary Interface
  */
 uint32_t
-elf_hash(const string &text)
+elf_hash(std::string_view text)
 {
     uint32_t h = 0;
     for (auto c : text) {
@@ -36,14 +37,13 @@ elf_hash(const string &text)
     return (h);
 }
 
-uint32_t gnu_hash(const char *s) {
-    const  auto * name = reinterpret_cast<const uint8_t *>(s);
-    uint32_t h = 5381;
-    while (*name != 0)
-        h = (h << 5U) + h + *name++;
-    return h;
 }
 
+uint32_t gnuHash(std::string_view name) noexcept {
+    uint32_t h = 5381;
+    for (auto c : name)
+        h = (h << 5U) + h + uint8_t(c);
+    return h;
 }
 
 Notes::iterator
@@ -163,28 +163,36 @@ std::optional<VersionIdx> Object::versionIdxForSymbol(size_t idx) const {
    return VersionIdx(gnu_version.io()->readObj<Half>(idx * 2));
 }
 
-std::pair<uint32_t, Sym>
-GnuHash::findSymbol(const char *name) const {
-    auto symhash = gnu_hash(name);
-
-    auto bloomword = hash->readObj<Elf::Off>(bloomoff((symhash/ELF_BITS) % header.bloom_size));
+bool
+GnuHash::bloomMayContain(uint32_t symhash) const {
+    auto bloomword = readDirect<Elf::Off>(*hash, hashData, bloomoff((symhash/ELF_BITS) % header.bloom_size));
 
     Elf::Off mask = Elf::Off(1) << symhash % ELF_BITS |
                     Elf::Off(1) << (symhash >> header.bloom_shift) % ELF_BITS;
 
-    if ((bloomword & mask) != mask) {
+    return (bloomword & mask) == mask;
+}
+
+std::pair<uint32_t, Sym>
+GnuHash::findSymbol(std::string_view name, uint32_t symhash) const {
+    if (!bloomMayContain(symhash))
        return std::make_pair(0, undef());
-    }
+    return findInChain(name, symhash);
+}
 
-    auto idx = hash->readObj<uint32_t>(bucketoff(symhash % header.nbuckets));
+std::pair<uint32_t, Sym>
+GnuHash::findInChain(std::string_view name, uint32_t symhash) const {
+    auto idx = readDirect<uint32_t>(*hash, hashData, bucketoff(symhash % header.nbuckets));
     if (idx < header.symoffset) {
         return std::make_pair(0, undef());
     }
     for (;;) {
-        auto sym = syms->readObj<Sym>(idx * sizeof (Sym));
-        auto chainhash = hash->readObj<uint32_t>(chainoff(idx - header.symoffset));
-        if ((chainhash | 1U)  == (symhash | 1U) && strings->readString(sym.st_name) == name)
-              return std::make_pair(idx, sym);
+        auto chainhash = readDirect<uint32_t>(*hash, hashData, chainoff(idx - header.symoffset));
+        if ((chainhash | 1U)  == (symhash | 1U)) {
+            auto sym = readDirect<Sym>(*syms, symData, idx * sizeof (Sym));
+            if (strings->stringEquals(sym.st_name, name))
+                return std::make_pair(idx, sym);
+        }
         if ((chainhash & 1U) != 0) {
            return std::make_pair(0, undef());
         }
@@ -193,19 +201,22 @@ GnuHash::findSymbol(const char *name) const {
 }
 
 SymbolSection &Object::debugSymbols() const {
-    return getSymtab(debugSymbols_, ".symtab", SHT_SYMTAB);
+    return getSymtab(debugSymbols_, debugSymbolsOnce, ".symtab", SHT_SYMTAB);
 }
 
 SymbolSection &Object::dynamicSymbols() const {
-    return getSymtab(dynamicSymbols_, ".dynsym", SHT_DYNSYM);
+    return getSymtab(dynamicSymbols_, dynamicSymbolsOnce, ".dynsym", SHT_DYNSYM);
 }
 
+// Threads unwinding stacks concurrently can look up symbols in the same
+// object, so only the first to get here loads the table.
 SymbolSection &
-Object::getSymtab(std::unique_ptr<SymbolSection> &table, const char *name, int type) const {
-    if (table == nullptr) {
+Object::getSymtab(std::unique_ptr<SymbolSection> &table, std::once_flag &once,
+      const char *name, int type) const {
+    std::call_once(once, [&] {
         const Section &sec {getDebugSection( name, type )};
         table = std::make_unique<SymbolSection>(sec.io(), getLinkedSection(sec).io());
-    }
+    });
     return *table;
 }
 
@@ -214,7 +225,6 @@ Object::Object(Context &context_, Reader::csptr io_, bool isDebug)
     , io(std::move(io_))
     , isDebug(isDebug)
     , elfHeader(io->readObj<Ehdr>(0))
-    , debugLoaded(isDebug) // don't attempt to load separate debug info for a debug ELF.
     , lastSegmentForAddress(nullptr)
 {
     /* Validate the ELF header */
@@ -232,44 +242,43 @@ Object::Object(Context &context_, Reader::csptr io_, bool isDebug)
 }
 
 const Object::SectionHeaders & Object::sectionHeaders() const {
-    // Make sure the header sections are present in the reader, otherwise, skip.
-    if (sectionHeaders_)
-       return *sectionHeaders_;
-
-    sectionHeaders_ = std::make_unique<SectionHeaders>();
-    if (elfHeader.e_shoff < io->size()) {
-       size_t headerCount = elfHeader.e_shnum;
-       if (headerCount == 0 && elfHeader.e_shentsize != 0) {
-          // work out the true headerCount form the sh_size field on the first
-          // iteration of the loop below.
-          headerCount = 65536;
-       }
-       sectionHeaders_->reserve(headerCount);
-       for (Elf::Off off = elfHeader.e_shoff, i = 0; i < headerCount; i++) {
-           sectionHeaders_->push_back(std::make_unique<Section>(this, off, i));
-           if (i == 0 && elfHeader.e_shnum == 0) {
-               headerCount = (*sectionHeaders_)[0]->shdr.sh_size;
-               sectionHeaders_->reserve(headerCount);
+    // Threads unwinding concurrently may all want the headers first.
+    std::call_once(sectionHeadersOnce, [this] {
+        sectionHeaders_ = std::make_unique<SectionHeaders>();
+        if (elfHeader.e_shoff < io->size()) {
+           size_t headerCount = elfHeader.e_shnum;
+           if (headerCount == 0 && elfHeader.e_shentsize != 0) {
+              // work out the true headerCount form the sh_size field on the first
+              // iteration of the loop below.
+              headerCount = 65536;
            }
-           off += elfHeader.e_shentsize;
-       }
-       if (elfHeader.e_shstrndx != SHN_UNDEF) {
-          // Create a mapping from section header names to section headers.
-          // We need to deal with the fact that e_shstrndx might be too small
-          // to hold the index of the string section, and look in sh_link if so.
-          size_t shstrSec = elfHeader.e_shstrndx == SHN_XINDEX ?
-             (*sectionHeaders_)[0]->shdr.sh_link : elfHeader.e_shstrndx;
-          auto &sshdr = (*sectionHeaders_)[shstrSec];
-          size_t secid = 0;
-          for (auto &h : *sectionHeaders_) {
-              auto name = sshdr->io()->readString(h->shdr.sh_name);
-              namedSection[name] = secid++;
-              h->name = name;
-          }
-       }
-    }
-    if (sectionHeaders_->size() == 0)
-        sectionHeaders_->push_back(std::make_unique<Section>());
+           sectionHeaders_->reserve(headerCount);
+           for (Elf::Off off = elfHeader.e_shoff, i = 0; i < headerCount; i++) {
+               sectionHeaders_->push_back(std::make_unique<Section>(this, off, i));
+               if (i == 0 && elfHeader.e_shnum == 0) {
+                   headerCount = (*sectionHeaders_)[0]->shdr.sh_size;
+                   sectionHeaders_->reserve(headerCount);
+               }
+               off += elfHeader.e_shentsize;
+           }
+           if (elfHeader.e_shstrndx != SHN_UNDEF) {
+              // Create a mapping from section header names to section headers.
+              // We need to deal with the fact that e_shstrndx might be too small
+              // to hold the index of the string section, and look in sh_link if so.
+              size_t shstrSec = elfHeader.e_shstrndx == SHN_XINDEX ?
+                 (*sectionHeaders_)[0]->shdr.sh_link : elfHeader.e_shstrndx;
+              auto &sshdr = (*sectionHeaders_)[shstrSec];
+              size_t secid = 0;
+              for (auto &h : *sectionHeaders_) {
+                  auto name = sshdr->io()->readString(h->shdr.sh_name);
+                  namedSection[name] = secid++;
+                  h->name = name;
+              }
+           }
+        }
+        if (sectionHeaders_->size() == 0)
+            sectionHeaders_->push_back(std::make_unique<Section>());
+    });
     return *sectionHeaders_;
 }
 
@@ -352,10 +361,9 @@ Object::symbolVersions() const
 const Phdr *
 Object::getSegmentForAddress(Off a) const
 {
-    if (lastSegmentForAddress != nullptr &&
-          lastSegmentForAddress->p_vaddr <= a &&
-          lastSegmentForAddress->p_vaddr + lastSegmentForAddress->p_memsz > a)
-       return lastSegmentForAddress;
+    const Phdr *last = lastSegmentForAddress;
+    if (last != nullptr && last->p_vaddr <= a && last->p_vaddr + last->p_memsz > a)
+       return last;
     const auto &hdrs = getSegments(PT_LOAD);
 
     auto pos = std::lower_bound(hdrs.begin(), hdrs.end(), a,
@@ -364,7 +372,7 @@ Object::getSegmentForAddress(Off a) const
                    header.p_vaddr + header.p_memsz != 0; });
     if (pos != hdrs.end() && pos->p_vaddr <= a) {
         lastSegmentForAddress = &*pos;
-        return lastSegmentForAddress;
+        return &*pos;
     }
     return nullptr;
 }
@@ -414,31 +422,76 @@ Elf::Object::sptr Object::debugData() const {
     return debugData_;
 }
 
-std::optional<std::pair<Sym, std::string>>
-Object::findSym(auto &table, Addr addr, int type) {
-    Sym sym;
-    std::string name;
-    for (const auto &candidate : table) {
-        if (candidate.st_shndx >= sectionHeaders().size())
-            continue;
-        if (type != STT_NOTYPE && ELF_ST_TYPE(candidate.st_info) != type)
-            continue;
-        if (candidate.st_value > addr)
-            continue;
-        if (candidate.st_size + candidate.st_value <= addr) {
-            if (candidate.st_size == 0 && candidate.st_value == addr) {
-                sym = candidate;
-                name = table.name(candidate);
-            }
+SymbolAddressIndex::SymbolAddressIndex(SymbolSection &table,
+      const std::function<bool(const Sym &)> &include)
+{
+    struct Entry {
+        Addr start;
+        Addr size;
+        uint32_t index;
+        uint8_t type;
+    };
+    std::vector<Entry> entries;
+    uint32_t idx = 0;
+    for (const auto &sym : table) {
+        if (sym.st_size != 0 && include(sym))
+            entries.push_back({ sym.st_value, sym.st_size, idx, uint8_t(ELF_ST_TYPE(sym.st_info)) });
+        ++idx;
+    }
+    std::ranges::sort(entries, [](const Entry &l, const Entry &r) {
+        return l.start < r.start || (l.start == r.start && l.index < r.index); });
+
+    starts.reserve(entries.size());
+    sizes.reserve(entries.size());
+    maxEnds.reserve(entries.size());
+    indices.reserve(entries.size());
+    types.reserve(entries.size());
+    Addr maxEnd = 0;
+    for (const auto &entry : entries) {
+        maxEnd = std::max(maxEnd, entry.start + entry.size);
+        starts.push_back(entry.start);
+        sizes.push_back(entry.size);
+        maxEnds.push_back(maxEnd);
+        indices.push_back(entry.index);
+        types.push_back(entry.type);
+    }
+}
+
+std::optional<uint32_t>
+SymbolAddressIndex::find(Addr addr, int type) const
+{
+    // Walk back from the last symbol starting at or before addr, until no
+    // earlier symbol can reach addr. Where symbols overlap, the linear scan
+    // this replaces returned the one first in the table, so we do too.
+    std::optional<uint32_t> best;
+    size_t i = std::upper_bound(starts.begin(), starts.end(), addr) - starts.begin();
+    while (i-- != 0 && maxEnds[i] > addr) {
+        if (addr - starts[i] >= sizes[i])
             continue;
-        }
-        auto &sec = sectionHeaders()[candidate.st_shndx];
-        if ((sec->shdr.sh_flags & SHF_ALLOC) == 0)
+        if (type != STT_NOTYPE && types[i] != type)
             continue;
-        return std::make_pair(candidate, table.name(candidate));
+        if (!best || indices[i] < *best)
+            best = indices[i];
     }
-    return std::nullopt;
-};
+    return best;
+}
+
+std::optional<std::pair<Sym, std::string>>
+Object::findSym(SymbolSection &table, std::unique_ptr<SymbolAddressIndex> &index, Addr addr, int type) {
+    if (index == nullptr) {
+        // Symbols without a size never match an address, and neither do
+        // those in sections that don't occupy memory.
+        index = std::make_unique<SymbolAddressIndex>(table, [this](const Sym &sym) {
+            return sym.st_shndx < sectionHeaders().size()
+                && (sectionHeaders()[sym.st_shndx]->shdr.sh_flags & SHF_ALLOC) != 0;
+        });
+    }
+    auto found = index->find(addr, type);
+    if (!found)
+        return std::nullopt;
+    Sym sym = table[*found];
+    return std::make_pair(sym, table.name(sym));
+}
 
 /*
  * Find the symbol that represents a particular address.
@@ -446,9 +499,9 @@ Object::findSym(auto &table, Addr addr, int type) {
 std::optional<std::pair<Sym, string>>
 Object::findSymbolByAddress(Addr addr, int type)
 {
-    if (auto res = findSym(debugSymbols(), addr, type); res)
+    if (auto res = findSym(debugSymbols(), debugSymbolsByAddress_, addr, type); res)
         return res;
-    if (auto res = findSym(dynamicSymbols(), addr, type); res)
+    if (auto res = findSym(dynamicSymbols(), dynamicSymbolsByAddress_, addr, type); res)
         return res;
     if (auto dd = debugData(); dd) {
         auto debugSym = dd->findSymbolByAddress(addr, type);
@@ -522,7 +575,7 @@ Object::getLinkedSection(const Section &from) const
  * section)
  */
 std::pair<Sym, size_t>
-Object::findDynamicSymbol(const std::string &name)
+Object::findDynamicSymbol(std::string_view name)
 {
     Sym sym;
     uint32_t idx = 0;
@@ -538,24 +591,69 @@ Object::findDynamicSymbol(const std::string &name)
     return {sym, idx};
 }
 
+bool
+Object::mayHaveDynamicSymbol(uint32_t gnuHash) const
+{
+    // Without a .gnu.hash section, we have no bloom filter to consult.
+    auto table = gnu_hash();
+    return table == nullptr || table->bloomMayContain(gnuHash);
+}
+
 std::pair<Sym, size_t>
-Object::findDebugSymbol(const string &name)
+Object::findDebugSymbol(std::string_view name)
 {
-    // Cache all debug symbols the first time we scan them.
-    //
+    // Index all debug symbols the first time we scan them.
     auto &syms = debugSymbols();
-    if (!cachedSymbols) {
-       cachedSymbols = std::make_unique<std::map<std::string, size_t>>();
-       size_t idx = 0;
-       for (auto sym : syms)
-          (*cachedSymbols)[syms.name(sym)] = idx++;
-    }
-    auto iter = cachedSymbols->find(name);
-    if (iter != cachedSymbols->end())
-       return { syms[iter->second], iter->second };
+    std::call_once(debugSymbolsByNameOnce, [&] {
+       debugSymbolsByName_ = std::make_unique<SymbolNameIndex>(syms);
+    });
+    auto idx = debugSymbolsByName_->find(name);
+    if (idx)
+       return { syms[*idx], *idx };
     return {undef(), 0};
 }
 
+SymbolNameIndex::SymbolNameIndex(SymbolSection &table_)
+    : table(table_)
+{
+    size_t count = table_.size();
+    size_t size = 16;
+    while (size < count * 2)
+        size *= 2;
+    slots.assign(size, Slot{ 0, EMPTY, 0 });
+    mask = size - 1;
+
+    uint32_t idx = 0;
+    for (const auto &sym : table_) {
+        std::string copy; // only used if the string table is not in memory.
+        auto view = table.nameView(sym.st_name);
+        std::string_view name = view ? *view : std::string_view(copy = table.name(sym));
+        uint32_t hash = gnuHash(name);
+        for (size_t pos = hash & mask;; pos = (pos + 1) & mask) {
+            Slot &slot = slots[pos];
+            if (slot.symIdx == EMPTY || (slot.hash == hash
+                     && (slot.nameOff == sym.st_name || table.nameEquals(slot.nameOff, name)))) {
+                slot = { hash, idx, sym.st_name };
+                break;
+            }
+        }
+        ++idx;
+    }
+}
+
+std::optional<uint32_t>
+SymbolNameIndex::find(std::string_view name) const
+{
+    uint32_t hash = gnuHash(name);
+    for (size_t pos = hash & mask;; pos = (pos + 1) & mask) {
+        const Slot &slot = slots[pos];
+        if (slot.symIdx == EMPTY)
+            return std::nullopt;
+        if (slot.hash == hash && table.nameEquals(slot.nameOff, name))
+            return slot.symIdx;
+    }
+}
+
 BuildID Object::getBuildID() const {
     if (isDebug) {
        // For debug objects, don't trust the notes segments are accurate
@@ -595,9 +693,16 @@ BuildID Object::getBuildID() const {
 const Object *
 Object::getDebug() const
 {
-    if (debugLoaded || context.options.noExtDebug)
+    if (isDebug || context.options.noExtDebug)
         return debugObject.get();
-    debugLoaded = true;
+    // Several threads may need the debug object at once: load it only once.
+    std::call_once(debugLoaded, [this] { loadDebug(); });
+    return debugObject.get();
+}
+
+void
+Object::loadDebug() const
+{
 
     // Use the build ID to find debug data.
     auto bid = getBuildID();
@@ -615,7 +720,7 @@ Object::getDebug() const
     }
 
     if (!debugObject)
-       return nullptr;
+       return;
 
     auto dbid = debugObject->getBuildID();
     if (dbid != bid)
@@ -645,7 +750,6 @@ Object::getDebug() const
             for (auto &sect : sectType.second)
                 sect.p_vaddr += diff;
     }
-    return debugObject.get();
 }
 
 SymHash::SymHash(Reader::csptr hash_,
@@ -653,56 +757,105 @@ SymHash::SymHash(Reader::csptr hash_,
     : hash(std::move(hash_))
     , syms(std::move(syms_))
     , strings(std::move(strings_))
+    , symData(syms->span(0, syms->size()))
 {
-    // read the hash table into local memory.
+    // Use the table in place if we can, otherwise read it into local memory.
     size_t words = hash->size() / sizeof (Word);
-    data.resize(words);
-    hash->readObj(0, data.data(), words);
-    nbucket = data[0];
-    nchain = data[1];
-    buckets = data.data() + 2;
+    auto direct = hash->span(0, words * sizeof (Word));
+    const Word *table;
+    if (direct.size() == words * sizeof (Word)
+          && reinterpret_cast<uintptr_t>(direct.data()) % alignof(Word) == 0) {
+        table = reinterpret_cast<const Word *>(direct.data());
+    } else {
+        data.resize(words);
+        hash->readObj(0, data.data(), words);
+        table = data.data();
+    }
+    nbucket = table[0];
+    nchain = table[1];
+    buckets = table + 2;
     chains = buckets + nbucket;
 }
 
 std::pair<uint32_t, Sym>
-SymHash::findSymbol(const string &name)
+SymHash::findSymbol(std::string_view name) const
 {
     uint32_t bucket = elf_hash(name) % nbucket;
     for (Word i = buckets[bucket]; i != STN_UNDEF; i = chains[i]) {
-        auto candidate = syms->readObj<Sym>(i * sizeof (Sym));
-        auto candidateName = strings->readString(candidate.st_name);
-        if (candidateName == name)
+        auto candidate = readDirect<Sym>(*syms, symData, i * sizeof (Sym));
+        if (strings->stringEquals(candidate.st_name, name))
             return std::make_pair(i, candidate);
     }
     return std::make_pair(0, undef());
 }
 
+namespace {
+// Sections up to Options::lazyDecompressSize are decompressed up front.
+// Larger ones are decoded lazily, so we don't have to hold all of a huge
+// .debug_info in memory to read one unit from it.
+Reader::csptr
+inflatedReader(const Context &context, size_t inflatedSize, Reader::csptr compressed)
+{
+    if (inflatedSize > context.options.lazyDecompressSize)
+        return make_shared<StreamingInflateReader>(inflatedSize, std::move(compressed));
+    return make_shared<InflateReader>(inflatedSize, *compressed);
+}
+
+// The same for zstd, where ZstdReader decodes from checkpoints within the
+// frame. If the frame's window is the whole section, there's nowhere to
+// checkpoint, and decoding any of it means holding all of it, so we may as
+// well do that up front.
+Reader::csptr
+zstdReader(const Context &context, size_t decodedSize, Reader::csptr compressed)
+{
+    if (decodedSize > context.options.lazyDecompressSize && zstdCanCheckpoint(*compressed))
+        return make_shared<ZstdReader>(std::move(compressed));
+    return make_shared<ZstdMemReader>(decodedSize, *compressed);
+}
+}
+
 Section::Section(const Object *elf, Off off, size_t idx) : shdr{}, index{idx}, elf(elf) {
     elf->io->readObj(off, &shdr);
 }
 
 Reader::csptr Section::io() const {
-    if (io_ != nullptr)
-        return io_;
+    std::call_once(ioOnce, [this] { makeIo(); });
+    return io_;
+}
 
+void Section::makeIo() const {
     if (shdr.sh_type == SHT_NULL) {
         io_ = make_shared<NullReader>();
-        return io_;
+        return;
     }
 
     // deal with two possible zlib-compressed sections. The sane,
     // "SHF_COMPRESSED" version, and the hacky ".zdebug_" versions.
-    bool wantedZlib = false;
+    // SHF_COMPRESSED sections may also be zstd compressed.
+    const char *wantedLibrary = nullptr;
 
     auto rawIo = elf->io->view(name, shdr.sh_offset, shdr.sh_size);
     if ((shdr.sh_flags & SHF_COMPRESSED) != 0) {
-        if (zlibAvailable()) {
-            auto chdr = rawIo->readObj<Chdr>(0);
-            io_ = make_shared<InflateReader>(
-                  chdr.ch_size,
-                  *rawIo->view("ZLIB compressed content after chdr", sizeof chdr, shdr.sh_size - sizeof chdr));
-        } else {
-            wantedZlib = true;
+        auto chdr = rawIo->readObj<Chdr>(0);
+        auto content = rawIo->view("compressed content after chdr", sizeof chdr, shdr.sh_size - sizeof chdr);
+        switch (chdr.ch_type) {
+            case ELFCOMPRESS_ZLIB:
+                if (zlibAvailable())
+                    io_ = inflatedReader(elf->context, chdr.ch_size, content);
+                else
+                    wantedLibrary = "zlib";
+                break;
+            case ELFCOMPRESS_ZSTD:
+                if (zstdAvailable())
+                    io_ = zstdReader(elf->context, chdr.ch_size, content);
+                else
+                    wantedLibrary = "zstd";
+                break;
+            default:
+                if (elf->context.debug)
+                    *(elf->context.debug) << "warning: unknown compression type " << chdr.ch_type
+                        << " for section " << name << " of " << *elf->io << std::endl;
+                break;
         }
     } else if (name.rfind(".zdebug_", 0) == 0) {
         unsigned char sig[12];
@@ -714,27 +867,26 @@ Reader::csptr Section::io() const {
                     sz <<= 8;
                     sz |= sig[i];
                 }
-                io_ = make_shared<InflateReader>(
-                      sz,
-                      *rawIo->view("ZLIB compressed content after magic signature", sizeof sig, sz));
+                io_ = inflatedReader(elf->context, sz,
+                      rawIo->view("ZLIB compressed content after magic signature", sizeof sig, sz));
             } else {
-                wantedZlib = true;
+                wantedLibrary = "zlib";
             }
         }
     } else {
         io_ = rawIo;
     }
-    if (wantedZlib) {
+    if (wantedLibrary != nullptr) {
         static bool warned = false;
         if (!warned && elf->context.debug) {
             warned = true;
-            *(elf->context.debug) << "warning: zlib not available at runtime, cannot decompress section "
+            *(elf->context.debug) << "warning: " << wantedLibrary
+                << " not available at runtime, cannot decompress section "
                 << name << " of " << *elf->io << std::endl;
         }
     }
     if (io_ == nullptr)
         io_ = make_shared<NullReader>();
-    return io_;
 }
 
 namespace {
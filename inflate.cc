@@ -4,12 +4,16 @@
 #include <dlfcn.h>
 #include <zlib.h>
 
+#include <algorithm>
+
 namespace {
 
 struct Zlib {
     int  (*inflateInit2_)(z_streamp, int, const char *, int);
     int  (*inflate)(z_streamp, int);
     int  (*inflateEnd)(z_streamp);
+    int  (*inflatePrime)(z_streamp, int, int);
+    int  (*inflateSetDictionary)(z_streamp, const Bytef *, uInt);
 };
 
 const Zlib *loadZlib() {
@@ -21,7 +25,10 @@ const Zlib *loadZlib() {
         zlib.inflateInit2_ = reinterpret_cast<decltype(zlib.inflateInit2_)>(dlsym(handle, "inflateInit2_"));
         zlib.inflate       = reinterpret_cast<decltype(zlib.inflate)>      (dlsym(handle, "inflate"));
         zlib.inflateEnd    = reinterpret_cast<decltype(zlib.inflateEnd)>   (dlsym(handle, "inflateEnd"));
-        if (!zlib.inflateInit2_ || !zlib.inflate || !zlib.inflateEnd) {
+        zlib.inflatePrime  = reinterpret_cast<decltype(zlib.inflatePrime)> (dlsym(handle, "inflatePrime"));
+        zlib.inflateSetDictionary = reinterpret_cast<decltype(zlib.inflateSetDictionary)>(dlsym(handle, "inflateSetDictionary"));
+        if (!zlib.inflateInit2_ || !zlib.inflate || !zlib.inflateEnd ||
+                !zlib.inflatePrime || !zlib.inflateSetDictionary) {
             dlclose(handle);
             return nullptr;
         }
@@ -78,4 +85,156 @@ InflateReader::InflateReader(size_t inflatedSize, const Reader &upstream)
     zlib->inflateEnd(&stream);
 }
 
+namespace {
+constexpr size_t windowSize = 32768; // the largest window deflate uses.
+}
+
+// The state of an inflation in progress.
+struct StreamingInflateReader::Stream {
+    z_stream strm{};
+    bool initialized = false;
+    bool ended = false;
+    Off out = 0; // inflated bytes so far.
+    Off in = 0; // offset of the next input to read from upstream.
+    Off chunkOffset = 0; // start of the chunk we are filling.
+    std::vector<char> chunk; // inflated data from chunkOffset.
+    unsigned char window[windowSize];
+    unsigned char input[65536];
+
+    ~Stream() { end(); }
+    void end() {
+        if (initialized)
+            loadZlib()->inflateEnd(&strm);
+        initialized = false;
+    }
+    // Start inflating from a checkpoint, filling chunks from chunkOffset_.
+    void start(const Reader &upstream, const Checkpoint &cp, Off chunkOffset_) {
+        auto *zlib = loadZlib();
+        end();
+        strm = z_stream{};
+        // Resuming in the middle of the stream means raw deflate data.
+        int windowBits = cp.out == 0 ? 15 : -15;
+        if (zlib->inflateInit2_(&strm, windowBits, ZLIB_VERSION, (int)sizeof strm) != Z_OK)
+            throw (Exception() << "inflateInit2 failed");
+        initialized = true;
+        in = cp.in;
+        if (cp.bits != 0) {
+            unsigned char partial = upstream.readObj<unsigned char>(cp.in - 1);
+            zlib->inflatePrime(&strm, cp.bits, partial >> (8 - cp.bits));
+        }
+        if (!cp.window.empty())
+            zlib->inflateSetDictionary(&strm, cp.window.data(), uInt(cp.window.size()));
+        out = cp.out;
+        ended = false;
+        chunkOffset = chunkOffset_;
+        chunk.clear();
+    }
+};
+
+StreamingInflateReader::StreamingInflateReader(size_t inflatedSize_, Reader::csptr upstream_,
+      Off checkpointInterval_, size_t cacheBytes)
+    : ChunkedReader(1024 * 1024, cacheBytes)
+    , upstream(std::move(upstream_))
+    , inflatedSize(inflatedSize_)
+    , checkpointInterval(std::max(checkpointInterval_, Off(windowSize)))
+{
+    if (!loadZlib())
+        throw (Exception() << "zlib not available at runtime");
+    checkpoints.push_back(Checkpoint{ 0, 0, 0, {} });
+}
+
+StreamingInflateReader::~StreamingInflateReader() = default;
+
+// Inflate until the chunk at chunkOffset is complete, recording checkpoints
+// as we go past the last one.
+void
+StreamingInflateReader::decodeChunk(Off chunkOffset) const
+{
+    auto *zlib = loadZlib();
+    // Find the last checkpoint at or before the chunk. If the stream we have
+    // is between it and the chunk, we can just carry on with that.
+    auto cp = std::upper_bound(checkpoints.begin(), checkpoints.end(), chunkOffset,
+          [](Off off, const Checkpoint &cp) { return off < cp.out; }) - 1;
+    if (!stream)
+        stream = std::make_unique<Stream>();
+    Stream &s = *stream;
+    if (!s.initialized || s.ended || s.out > chunkOffset || s.out < cp->out) {
+        s.start(*upstream, *cp, chunkOffset);
+    } else if (s.chunkOffset != chunkOffset) {
+        // Skip forward to the chunk we want.
+        s.chunk.clear();
+        s.chunkOffset = chunkOffset;
+    }
+
+    while (!s.ended && s.chunkOffset <= chunkOffset) {
+        if (s.strm.avail_in == 0) {
+            size_t got = upstream->read(s.in, sizeof s.input, reinterpret_cast<char *>(s.input));
+            if (got == 0)
+                throw (Exception() << "truncated deflate stream in " << *upstream);
+            s.in += got;
+            s.strm.next_in = s.input;
+            s.strm.avail_in = uInt(got);
+        }
+        if (s.strm.avail_out == 0) {
+            s.strm.next_out = s.window;
+            s.strm.avail_out = windowSize;
+        }
+        unsigned char *produced = s.strm.next_out;
+        int rc = zlib->inflate(&s.strm, Z_BLOCK);
+        if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR)
+            throw (Exception() << "inflate failed in " << *upstream << ": " << rc);
+        size_t count = s.strm.next_out - produced;
+
+        // Keep any output that lands in the chunk we are filling.
+        for (size_t used = 0; used != count; ) {
+            Off pos = s.out + used;
+            if (pos < s.chunkOffset) {
+                used = std::min(count, size_t(s.chunkOffset - s.out));
+                continue;
+            }
+            size_t amount = std::min(count - used, chunkSize - s.chunk.size());
+            s.chunk.insert(s.chunk.end(), produced + used, produced + used + amount);
+            used += amount;
+            if (s.chunk.size() == chunkSize) {
+                addChunk(s.chunkOffset, std::move(s.chunk));
+                s.chunk = std::vector<char>();
+                s.chunkOffset += chunkSize;
+            }
+        }
+        s.out += count;
+
+        if (rc == Z_STREAM_END) {
+            s.ended = true;
+            if (!s.chunk.empty())
+                addChunk(s.chunkOffset, std::move(s.chunk));
+            s.chunk = std::vector<char>();
+            break;
+        }
+        // At the end of a deflate block, other than the last, we can record
+        // a checkpoint, with the window of output preceding it.
+        bool blockBoundary = (s.strm.data_type & 128) != 0 && (s.strm.data_type & 64) == 0;
+        if (blockBoundary && s.out >= checkpoints.back().out + checkpointInterval) {
+            Checkpoint next{ s.out, s.in - s.strm.avail_in, s.strm.data_type & 7, {} };
+            next.window.resize(windowSize);
+            size_t left = s.strm.avail_out; // the oldest output is after next_out.
+            std::copy(s.window + windowSize - left, s.window + windowSize, next.window.begin());
+            std::copy(s.window, s.window + windowSize - left, next.window.begin() + left);
+            checkpoints.push_back(std::move(next));
+        }
+    }
+}
+
+size_t
+StreamingInflateReader::checkpointCount() const
+{
+    std::lock_guard guard(lock);
+    return checkpoints.size();
+}
+
+void
+StreamingInflateReader::describe(std::ostream &os) const
+{
+    os << "inflated content from " << *upstream;
+}
+
 } // namespace pstack
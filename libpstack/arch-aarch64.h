@@ -132,5 +132,23 @@ void opReg(Regs &regs, Op op, int reg, Value &value) {
    }
 };
 
+
+// Register numbers and direct access to the general purpose registers, for
+// the fast unwind plans in dwarfproc.cc.
+struct UnwindArch {
+   static constexpr int SP = 31;
+   static constexpr int FP = 29;
+
+   template <typename User>
+   static auto gpr(User &user, int reg) -> decltype(&user.sp) {
+      switch (reg) {
+         case 0 ... 30: return &user.regs[reg];
+         case 31: return &user.sp;
+         case 32: return &user.pc;
+         default: return nullptr;
+      }
+   }
+};
+
 }
 
@@ -156,4 +156,28 @@ void opReg(Regs &regs, Op op, int reg, Value &value) {
          throw std::logic_error("unhandled register");
    }
 };
+
+// Register numbers and direct access to the general purpose registers, for
+// the fast unwind plans in dwarfproc.cc.
+struct UnwindArch {
+   static constexpr int SP = 4;
+   static constexpr int FP = 5;
+
+   template <typename User>
+   static auto gpr(User &user, int reg) -> decltype(&user.eax) {
+      switch (reg) {
+         case 0: return &user.eax;
+         case 1: return &user.ecx;
+         case 2: return &user.edx;
+         case 3: return &user.ebx;
+         case 4: return &user.esp;
+         case 5: return &user.ebp;
+         case 6: return &user.esi;
+         case 7: return &user.edi;
+         case 8: return &user.eip;
+         default: return nullptr;
+      }
+   }
+};
+
 }
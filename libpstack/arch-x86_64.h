@@ -266,5 +266,37 @@ void opReg(Regs &regs, Op op, int reg, Value &value) {
    }
 };
 
+
+// Register numbers and direct access to the general purpose registers, for
+// the fast unwind plans in dwarfproc.cc.
+struct UnwindArch {
+   static constexpr int SP = 7;
+   static constexpr int FP = 6;
+
+   template <typename User>
+   static auto gpr(User &user, int reg) -> decltype(&user.rax) {
+      switch (reg) {
+         case 0: return &user.rax;
+         case 1: return &user.rdx;
+         case 2: return &user.rcx;
+         case 3: return &user.rbx;
+         case 4: return &user.rsi;
+         case 5: return &user.rdi;
+         case 6: return &user.rbp;
+         case 7: return &user.rsp;
+         case 8: return &user.r8;
+         case 9: return &user.r9;
+         case 10: return &user.r10;
+         case 11: return &user.r11;
+         case 12: return &user.r12;
+         case 13: return &user.r13;
+         case 14: return &user.r14;
+         case 15: return &user.r15;
+         case 16: return &user.rip;
+         default: return nullptr;
+      }
+   }
+};
+
 }
 
@@ -0,0 +1,27 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace pstack {
+
+// Call fn(i) for each i in [0, count), sharing the work among up to "jobs"
+// threads, including the calling one.
+template <typename Fn> void
+forEachConcurrently(size_t count, size_t jobs, const Fn &fn)
+{
+    std::atomic<size_t> next { 0 };
+    auto worker = [&] {
+        for (size_t i; (i = next++) < count; )
+            fn(i);
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min(jobs, count); ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &thread : threads)
+        thread.join();
+}
+
+}
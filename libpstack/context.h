@@ -3,15 +3,24 @@
 #include <memory>
 #include <vector>
 #include <filesystem>
+#include <future>
 #include <optional>
 #include <limits>
 #include <optional>
+#include <mutex>
 #include <fcntl.h>
 
 struct debuginfod_client;
 
 namespace pstack {
 
+// How to read the memory of live processes.
+enum class LiveMemory {
+    AUTO, // use process_vm_readv if it works for the target, otherwise procfs.
+    PROCFS, // read /proc/<pid>/mem
+    VMREADV, // use process_vm_readv
+};
+
 struct Options {
     bool nosrc = false; // don't display source code (makes things faster)
     bool doargs = false; // show arguments to functions
@@ -22,6 +31,14 @@ struct Options {
     bool withDebuginfod = false; // use debuginfod client library.
     bool noBuildIds = false;
     bool noLocalFiles = false;
+    LiveMemory liveMemory = LiveMemory::AUTO;
+    size_t snapshotStack = 0; // if non-zero, copy this much of each thread's stack, and resume before unwinding.
+    int jobs = 1; // number of threads to use to unwind stacks.
+    bool prefetch = false; // open and index all mapped objects concurrently before unwinding.
+    std::filesystem::path indexCache; // if set, save and reuse address-to-unit indexes here.
+    static constexpr size_t defaultLz4CacheSize = 64 * 1024 * 1024;
+    size_t lz4CacheSize = defaultLz4CacheSize; // bytes of decompressed blocks to keep for lz4 cores.
+    size_t lazyDecompressSize = 64 * 1024 * 1024; // compressed sections bigger than this decompressed are decoded on demand.
     int maxdepth = std::numeric_limits<int>::max();
     int maxframes = 30;
 };
@@ -37,7 +54,12 @@ class Info;
 }
 
 class Context {
-   std::map<std::shared_ptr<Elf::Object>, std::shared_ptr<Dwarf::Info>> dwarfCache;
+   // Protects the image and DWARF caches: stacks may be unwound concurrently.
+   // Recursive, as loading an image can find and load its debug image.
+   std::recursive_mutex cacheLock;
+   // Each object's Info is built by the first thread to ask for it, and the
+   // others wait on the future for it.
+   std::map<std::shared_ptr<Elf::Object>, std::shared_future<std::shared_ptr<Dwarf::Info>>> dwarfCache;
 
    using NameMap = std::map<std::filesystem::path, std::shared_ptr<Elf::Object>>;
    using IdMap = std::map<Elf::BuildID, std::shared_ptr<Elf::Object>>;
@@ -8,6 +8,7 @@
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <stack>
 #include <string>
 #include <unordered_map>
@@ -17,6 +18,7 @@ namespace pstack::Dwarf {
 
 enum HasChildren { DW_CHILDREN_yes = 1, DW_CHILDREN_no = 0 };
 class DIE;
+class DIEArena;
 class Info;
 class LineInfo;
 class Unit;
@@ -53,6 +55,13 @@ enum UnitType {
 };
 #undef DWARF_UNIT_TYPE
 
+#define DWARF_IDX(a,b) a = (b),
+enum IndexAttr {
+#include "libpstack/dwarf/idx.h"
+    DW_IDX_none
+};
+#undef DWARF_IDX
+
 #define DWARF_FORM(a,b) a = (b),
 enum Form {
 #include "libpstack/dwarf/forms.h"
@@ -124,16 +133,20 @@ struct FormEntry {
 // Our interest in the attribute names is in order to find the index in the
 // sequence associated with a particular attribute, which is what we store in
 // attrName2Idx.
+//
+// Abbreviations belong to a unit, and are also compiled into a plan for
+// skipping over DIEs using them, given the unit's address and offset sizes.
 struct Abbreviation {
     Tag tag;
     bool hasChildren;
-    mutable bool sorted;
     std::vector<FormEntry> forms;
     using AttrNameEnt = std::pair<AttrName, size_t>;
     using AttrNameMap = std::vector<AttrNameEnt>;
     int nextSibIdx;
-    mutable AttrNameMap attrName2Idx; // mutable so we can sort on demand
-    explicit Abbreviation(DWARFReader &);
+    AttrNameMap attrName2Idx; // sorted by attribute name.
+    int fixedSize; // size of the attribute values, if all forms are fixed-size, else -1
+    int siblingOffset; // offset of DW_AT_sibling's value, if at a fixed offset, else -1
+    Abbreviation(DWARFReader &, const Unit &);
 };
 
 // An entry from a pubnames unit
@@ -153,6 +166,59 @@ struct PubnameUnit {
     explicit PubnameUnit(DWARFReader &r);
 };
 
+// A name found in one of the name indexes: the unit containing the named
+// entity, and, if the index records it, the entity's DIE.
+struct IndexedName {
+    Elf::Off unitOffset;
+    Elf::Off dieOffset; // 0 if the index only tells us the unit.
+};
+
+// The hashed name index in a DWARF 5 .debug_names section. The section holds
+// one name table per index unit, each mapping names to DIEs in its compile
+// units. We read the hash tables in place, only decoding the abbreviations
+// for each table up front.
+class DebugNames {
+    struct Abbrev {
+        Tag tag;
+        std::vector<std::pair<IndexAttr, Form>> attrs;
+    };
+    struct Table {
+        unsigned dwarfLen;
+        uint32_t bucketCount;
+        uint32_t nameCount;
+        Elf::Off buckets;
+        Elf::Off hashes;
+        Elf::Off stringOffsets;
+        Elf::Off entryOffsets;
+        Elf::Off entryPool;
+        std::vector<Elf::Off> units;
+        std::unordered_map<uintmax_t, Abbrev> abbrevs;
+    };
+    Reader::csptr io;
+    Reader::csptr strings;
+    std::vector<Table> tables;
+    void findEntries(const Table &, uint32_t idx, std::vector<IndexedName> &) const;
+public:
+    DebugNames(Reader::csptr io, Reader::csptr strings);
+    // Add the entities named "name" to "found".
+    void find(std::string_view name, std::vector<IndexedName> &found) const;
+};
+
+// The index in a .gdb_index section, as added by gdb-add-index. It maps each
+// name to the compile units that define it, but not to the DIEs themselves.
+class GdbIndex {
+    Reader::csptr io;
+    uint32_t version;
+    std::vector<Elf::Off> units;
+    Elf::Off symbolTable;
+    uint32_t symbolSlots;
+    Elf::Off constantPool;
+public:
+    explicit GdbIndex(Reader::csptr io);
+    // Add the units defining "name" to "found".
+    void find(std::string_view name, std::vector<IndexedName> &found) const;
+};
+
 // Data stored in a BLOCK form attribute.
 struct Block {
    Elf::Off offset;
@@ -182,6 +248,7 @@ class DIE {
 
     // DIEs are only constructed by units: hide constructors from everyone else.
     friend Unit;
+    friend DIEArena;
 
     Elf::Off offset{};
     class Raw;
@@ -197,8 +264,8 @@ class DIE {
         {}
 
     // Decode the raw DIE Content at the given offset within the .debug_info
-    // section for a particular unit.
-    static std::shared_ptr<Raw> decode(Unit *unit, const DIE &parent, Elf::Off offset);
+    // section for a particular unit, allocating it from the unit's arena.
+    static Raw *decode(Unit *unit, DIEArena &arena, const DIE &parent, Elf::Off offset);
 
     // Return the first child of this DIE (used by iterator implementation)
     [[nodiscard]] DIE firstChild() const;
@@ -300,6 +367,11 @@ public:
     // Get a human-readable name for a type die - ascends through namespaces
     // that contain this DIE, walks through pointers and references, etc.
     [[nodiscard]] std::string typeName() const;
+
+    // The DIE's name, qualified with the namespaces and types enclosing it,
+    // as the compiler writes it in .debug_pubnames, e.g. "ns::S". A
+    // definition outside its scope is qualified as its declaration is.
+    [[nodiscard]] std::string qualifiedName() const;
     [[nodiscard]] const std::unique_ptr<Ranges> &getRanges() const;
 
     DIE() = default;
@@ -310,11 +382,28 @@ public:
     ~DIE() = default;
 };
 
-// ARanges provides a fast way of finding the compilation unit associatd with a
-// machine address. Note because not all compilers contribute to aranges, a
-// miss on the aranges lookup does not mean there is no CU associated with the
-// address, so we may augment this with our own manual scan of each unit.
-using ARanges = std::map<Elf::Addr, std::pair<Elf::Addr, Elf::Off>>;
+// UnitIndex provides a fast way of finding the compilation unit associated
+// with a machine address. It is built from .debug_aranges where possible. Not
+// all compilers contribute to aranges, so a miss on an index built from
+// aranges alone does not mean there is no CU associated with the address, and
+// we may augment it with the ranges of each unit's root DIE. Ranges are held
+// in flat arrays sorted by start address, and the index can be saved and
+// loaded again, to avoid rebuilding it on each invocation.
+class UnitIndex {
+    std::vector<Elf::Addr> starts;
+    std::vector<Elf::Addr> ends;
+    std::vector<Elf::Addr> maxEnds; // highest end of any range up to this one.
+    std::vector<Elf::Off> units;
+public:
+    bool complete = false; // has ranges from all units, not just aranges.
+    void add(Elf::Addr start, Elf::Addr end, Elf::Off unit);
+    void sort(); // call after adding ranges, before using find.
+    [[nodiscard]] std::optional<Elf::Off> find(Elf::Addr addr) const;
+    [[nodiscard]] size_t size() const { return starts.size(); }
+    // "tag" identifies the data we were built from: load fails on mismatch.
+    void save(std::ostream &, uint64_t tag) const;
+    bool load(std::istream &, uint64_t tag);
+};
 
 // .eh_frame and .debug_frame have subtly different internals, but are almost
 // identical For when we need to discriminate, this is what we use.
@@ -362,6 +451,34 @@ public:
     explicit LineState(LineInfo *);
 };
 
+// A compact form of a line number matrix, for finding the row covering an
+// address. Rows are grouped by sequence, and the sequences sorted by address.
+// Each row has only a 32-bit address offset from the start of its sequence,
+// and 32-bit file index and line number, held in separate arrays, so a lookup
+// is a pair of binary searches over densely packed data.
+class LineTable {
+    struct Sequence {
+        Elf::Addr start;
+        Elf::Addr end;
+        Elf::Addr maxEnd; // highest end of any sequence up to this one.
+        uint32_t order; // position in the matrix: lowest wins on overlap.
+        uint32_t firstRow;
+        uint32_t rowCount; // includes the terminating end_sequence row.
+    };
+    std::vector<Sequence> sequences;
+    std::vector<uint32_t> addrOffsets;
+    std::vector<uint32_t> files;
+    std::vector<uint32_t> lines;
+public:
+    struct Row {
+        uint32_t file; // index into LineInfo::files
+        uint32_t line;
+    };
+    LineTable() = default;
+    LineTable(const std::vector<LineState> &matrix, const std::vector<FileEntry> &files);
+    [[nodiscard]] std::optional<Row> find(Elf::Addr addr) const;
+};
+
 class LineInfo {
 public:
     LineInfo(const LineInfo &) = delete;
@@ -377,6 +494,7 @@ public:
     std::vector<std::string> directories;
     std::vector<FileEntry> files;
     std::vector<LineState> matrix;
+    LineTable table; // built from matrix, for address lookups.
     void build(DWARFReader &, Unit &);
 };
 
@@ -397,26 +515,61 @@ public:
     bool visit(Unit &, MacroVisitor *) const;
 };
 
+// Storage for the decoded DIEs of a unit. Raw DIEs, their attribute values
+// and blocks are bump-allocated in large chunks, and are never individually
+// freed - the whole arena goes at once. DIEs handed out by the unit share
+// ownership of the arena, so they remain valid after the unit is purged.
+class DIEArena {
+    std::vector<std::unique_ptr<char[]>> chunks;
+    char *next = nullptr;
+    size_t avail = 0;
+
+    // The index of decoded DIEs by offset. Most DIEs are decoded in offset
+    // order, and are appended to "sorted". Others go to "recent", also kept
+    // sorted, and merged into "sorted" when it grows too large.
+    using Entry = std::pair<Elf::Off, DIE::Raw *>;
+    std::vector<Entry> sorted;
+    std::vector<Entry> recent;
+public:
+    DIEArena() = default;
+    DIEArena(const DIEArena &) = delete;
+    DIEArena &operator = (const DIEArena &) = delete;
+
+    void *allocate(size_t size, size_t align);
+    // Only trivially destructible objects may be allocated here.
+    template <typename T, typename... Args> T *make(Args &&...args) {
+        static_assert(std::is_trivially_destructible_v<T>);
+        return new (allocate(sizeof (T), alignof (T))) T(std::forward<Args>(args)...);
+    }
+    // Find the slot for the DIE at an offset, or nullptr if it has not been
+    // decoded. A slot may hold nullptr if there is no DIE at the offset.
+    DIE::Raw **find(Elf::Off offset);
+    void insert(Elf::Off offset, DIE::Raw *raw);
+};
+
 // A (partial-) compilation unit.
 class Unit : public std::enable_shared_from_this<Unit> {
 
-    using Abbreviations = std::unordered_map<size_t, Abbreviation>;
-
     // We store DIEs as their "raw" counterparts - when used by the API, we
     // return a DIE to wrap them. The DIE wrapper includes a reference to the
     // unit, the DIE's offset.
     //
-    // Offsets here are relative to the debug_info section, rather than
-    // the unit - this makes the offsets unique within the Info.
-    using AllEntries = std::map<Elf::Off, std::shared_ptr<DIE::Raw>>;
-
+    // The raw DIEs live in an arena, indexed by their offsets. Offsets here
+    // are relative to the debug_info section, rather than the unit - this
+    // makes the offsets unique within the Info.
     std::shared_ptr<DIE::Raw> offsetToRawDIE(const DIE &parent, Elf::Off offset);
     // Used to ensure abbreviations and other potentially expensive data is
     // parsed. Internals will call this to undo a "purge()"
     void load();
 
-    Abbreviations abbreviations;
-    AllEntries allEntries;
+    // Abbreviations, in the order defined. Codes are usually small and dense,
+    // so we find them by indexing abbrevByCode (holding index + 1, or 0 for
+    // undefined codes), and fall back to a hash table otherwise.
+    std::vector<Abbreviation> abbreviations;
+    std::vector<uint32_t> abbrevByCode;
+    std::unordered_map<size_t, uint32_t> sparseAbbrevs;
+    std::shared_ptr<DIEArena> arena;
+    std::mutex entriesLock; // protects abbreviations and arena.
     Elf::Off rootOffset;
     Elf::Off abbrevOffset;
     std::unique_ptr<LineInfo> lines;
@@ -455,7 +608,7 @@ public:
 
     Unit(const Info *, DWARFReader &);
 
-    void purge(); // Remove all "raw" DIEs from allEntries, potentially freeing memory.
+    void purge(); // Release the arena of "raw" DIEs, once no DIEs refer to it.
 
     // Is a given DIE the root for this unit?
     [[nodiscard]] bool isRoot(const DIE &die) const {
@@ -478,6 +631,15 @@ public:
     bool sourceFromAddr(Elf::Addr addr, std::vector<std::pair<std::string, int>> &info);
     const Abbreviation *findAbbreviation(size_t) const;
 
+    // The size of a value in the given form in this unit, or -1 if it varies.
+    [[nodiscard]] int formSize(Form) const;
+    // Skip over a value in the given form.
+    void skipForm(DWARFReader &, Form) const;
+    // Skip over the sequence of sibling DIEs starting at the given offset,
+    // and all their descendants, without decoding them. Returns the offset
+    // following the sequence's terminating null entry.
+    Elf::Off skipEntries(Elf::Off offset) const;
+
     // For _strx forms, indirect through debugStrOffsets to get a string for a
     // specific index.
     std::string strx(size_t idx);
@@ -491,6 +653,7 @@ public:
 };
 
 struct CallFrame;
+class UnwindTable;
 
 // A frame-descriptor-entry describes the details of how to unwind the stack
 // over a range of machine addresses to a caller.
@@ -502,8 +665,14 @@ struct FDE {
     CIE &cie;
     std::vector<unsigned char> augmentation;
     FDE(const CFI &, DWARFReader &, Elf::Off cieOff_, Elf::Off endOff_);
+    ~FDE();
     CallFrame execInsns(uintmax_t addr) const;
     CallFrame defaultFrame() const;
+    // The unwind rules for every address in the FDE, built on first use.
+    const UnwindTable &unwindTable() const;
+private:
+    mutable std::once_flag tableBuilt;
+    mutable std::unique_ptr<UnwindTable> table;
 };
 
 enum RegisterType {
@@ -540,6 +709,40 @@ struct CallFrame {
     CallFrame();
 };
 
+// A row of an unwind table: the CFA and register rules that apply from
+// "start" up to the start of the next row. The register rules for the row
+// live in the table's shared pool.
+struct UnwindRow {
+    Elf::Addr start;
+    int cfaReg;
+    RegisterUnwind cfaValue;
+    uint32_t firstRule;
+    uint32_t ruleCount;
+};
+
+// The result of executing all of an FDE's instructions once: one row for each
+// distinct location the instructions advance to, sorted by address. Looking
+// up a row is a binary search, rather than re-running the instructions for
+// each new address.
+class UnwindTable {
+public:
+    using Rule = std::pair<int, RegisterUnwind>;
+    explicit UnwindTable(const FDE &);
+    // Find the row for a (object-relative) address, or null if not covered.
+    [[nodiscard]] const UnwindRow *rowForAddr(Elf::Addr) const;
+    // The register rules for a row, sorted by register number.
+    [[nodiscard]] std::span<const Rule> rules(const UnwindRow &row) const {
+        return { ruleStore.data() + row.firstRule, row.ruleCount };
+    }
+    [[nodiscard]] const RegisterUnwind *findRule(const UnwindRow &, int reg) const;
+    [[nodiscard]] std::span<const UnwindRow> getRows() const { return rows; }
+private:
+    void addRow(Elf::Addr start, const CallFrame &);
+    std::vector<UnwindRow> rows;
+    std::vector<Rule> ruleStore;
+    Elf::Addr end;
+};
+
 // A CIE is a Common Information Entry, describing attributes of code and some
 // initial location instructions potentially shared by multiple FDEs
 struct CIE {
@@ -589,22 +792,22 @@ private:
     friend struct CIE;
     const Info *dwarf;
     Elf::Addr sectionAddr; // virtual address of section (either eh_frame or debug_frame.
-    Elf::Addr ehFrameHdrAddr; // virtual address of eh_frame_hdr
     FIType type;
     mutable CIEs cies;
 
-    // FDEs are sorted by their iloc field. If we have an fdeTable, then the
-    // table starts out with the correct size, but unpopulated, and searching
-    // for an FDE will lazily populate it from the fdeTable If the ELF object
-    // contains no eh_frame_hdr section, then we read the entire eh_frame
-    // section when we first construct the CFI object, and prepopulate this
-    // with al the FDEs. Currently, this happens for the VDSO in aarch64
-    // platforms (where there are just a handful of FDEs), and pretty much
-    // everything else has an eh_frame_hdr.
+    // The FDE index: the initial location of every FDE, sorted, and the
+    // offset of each FDE in the section, in parallel arrays. It's built in
+    // one pass from the search table in .eh_frame_hdr where there is one, or
+    // by skimming the headers of the entries in the section. An FDE is only
+    // decoded when a search finds it, and is then kept in "fdes", at the same
+    // index.
+    std::vector<Elf::Addr> fdeLocations;
+    std::vector<Elf::Off> fdeOffsets;
     mutable FDEs fdes;
+    mutable std::mutex fdeLock; // protects cies and fdes.
 
-    ExceptionHandlingEncoding fdeTableEnc; // the encoding format of the entries in fdeTable.
-    mutable Reader::csptr fdeTable; // the start of the table in the eh_frame_hdr section.
+    bool indexFromHeader(const Elf::Section &ehFrameHdrSec);
+    void indexFromSection();
     std::pair<bool, std::unique_ptr<FDE>> putFDEorCIE( DWARFReader &reader ) const;
 
     // cieOFF set to -1 if this is CIE, set to offset of associated CIE for an FDE
@@ -680,6 +883,7 @@ public:
     Info::sptr getAltDwarf() const;
 
     const std::list<PubnameUnit> &pubnames() const;
+    const std::list<PubnameUnit> &pubtypes() const;
 
     // get a unit, given an offset.
     Unit::sptr getUnit(Elf::Off offset) const;
@@ -690,8 +894,19 @@ public:
     // Given a debug_info-relative offset, find the associated DIE.
     DIE offsetToDIE(Elf::Off) const;
 
+    // Find the DIEs defining entities at the top level of a unit or
+    // namespace, given the name qualified with its namespaces, like
+    // DIE::qualifiedName. Uses .debug_names, .gdb_index, or .debug_pubnames
+    // and .debug_pubtypes if available, and scans all units otherwise.
+    std::vector<DIE> findDefinitions(std::string_view name) const;
+
+    // true if the object has an index findDefinitions can use, rather than
+    // scanning all units.
+    bool hasNameIndex() const;
+
     // Find the unit covering a given (object-relative) text address.
-    // Will use debug_aranges where possible.
+    // Will use debug_aranges where possible, and an index saved by an earlier
+    // invocation if the context has an index cache.
     Unit::sptr lookupUnit(Elf::Addr addr) const;
 
     // Find the source associated with a specific address. Due to inlining and
@@ -704,8 +919,6 @@ public:
     // The ELF object this DWARF data is associated with
     const Elf::Object::sptr elf;
 
-    // Cached call frames for specific return addresses.
-    std::map<Elf::Addr, CallFrame> callFrameForAddr;
 
     CFI *getCFI(FIType = FI_BEST) const;
 
@@ -723,16 +936,45 @@ private:
     // These are mutable so we can lazy-eval them when getters are called, and
     // maintain logical constness.
     mutable std::unique_ptr<std::list<PubnameUnit>> pubnameUnits { nullptr };
+    mutable std::unique_ptr<std::list<PubnameUnit>> pubtypeUnits { nullptr };
+    mutable std::unique_ptr<DebugNames> debugNames;
+    mutable std::unique_ptr<GdbIndex> gdbIndex;
+    // Qualified names from .debug_pubnames and .debug_pubtypes, or found by
+    // scanning the units if the object has no index at all.
+    struct NameHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view name) const { return std::hash<std::string_view>()(name); }
+    };
+    mutable std::unordered_map<std::string, std::vector<IndexedName>, NameHash, std::equal_to<>> names;
+    mutable bool haveNameIndex = false;
+    mutable std::once_flag nameIndexOnce;
+    mutable std::once_flag scanNamesOnce;
+    void loadNameIndex() const;
     mutable std::map<Elf::Off, Unit::sptr> units;
+
+    // The extent of each unit in .debug_info, in order. Found by skimming the
+    // unit headers, without decoding any DIEs, so we can map a DIE offset to
+    // its unit with a binary search.
+    struct UnitExtent {
+        Elf::Off offset;
+        Elf::Off end;
+    };
+    mutable std::vector<UnitExtent> unitExtents;
+    mutable std::once_flag unitExtentsOnce;
+    const std::vector<UnitExtent> &getUnitExtents() const;
     mutable Info::sptr altDwarf;
-    mutable std::unique_ptr<ARanges> aranges; // maps starting address to length + unit offset.
+    mutable std::unique_ptr<UnitIndex> unitIndex; // maps addresses to unit offsets.
+    mutable std::mutex unitIndexLock;
     mutable std::unique_ptr<Macros> macros;
     mutable std::map<FIType, std::unique_ptr<CFI>> cfi;
+    mutable std::mutex cfiLock;
 
     mutable bool altImageLoaded { false };
-    mutable bool unitRangesCached { false };
 
     void decodeARangeSet(DWARFReader &) const;
+    void indexUnitRanges() const;
+    std::filesystem::path unitIndexCachePath() const;
+    uint64_t unitIndexTag() const;
     std::filesystem::path getAltImageName() const;
 };
 
@@ -744,7 +986,7 @@ class DIE::Attribute {
     friend class DIE::Raw;
     // A generic value.
     union Value {
-        Value(DWARFReader &, const FormEntry &form, Unit *);
+        Value(DWARFReader &, const FormEntry &form, Unit *, DIEArena &);
         uintmax_t addr;
         uintmax_t signature;
         uintmax_t udata;
@@ -884,6 +1126,16 @@ Units::iterator::iterator(const Info *info_, Elf::Off offset)
 class DWARFReader {
     Elf::Off off;
     Elf::Off end;
+    // If the underlying reader holds its content in memory, we read directly
+    // from it rather than going through the reader's virtual interface.
+    std::span<const char> mem;
+    void fetch(void *to, size_t len) {
+       if (likely(off + len <= mem.size()))
+          memcpy(to, mem.data() + off, len);
+       else
+          io->readObj(off, static_cast<char *>(to), len);
+       off += len;
+    }
 public:
     Reader::csptr io;
     unsigned addrLen;
@@ -893,33 +1145,30 @@ public:
         , io(std::move(io_))
         , addrLen(ELF_BITS / 8)
         {
+           if (end != std::numeric_limits<size_t>::max())
+              mem = io->span(0, end);
         }
     void getBytes(size_t size, unsigned char *to) {
-       io->readObj(off, to, size);
-       off += size;
+       fetch(to, size);
     }
     uint32_t getu32() {
         unsigned char q[4];
-        io->readObj(off, q, 4);
-        off += sizeof q;
+        fetch(q, 4);
         return q[0] | q[1] << 8 | q[2] << 16 | uint32_t(q[3] << 24);
     }
     uint16_t getu16() {
         unsigned char q[2];
-        io->readObj(off, q, 2);
-        off += sizeof q;
+        fetch(q, 2);
         return q[0] | q[1] << 8;
     }
     uint8_t getu8() {
         unsigned char q;
-        io->readObj(off, &q, 1);
-        off++;
+        fetch(&q, 1);
         return q;
     }
     int8_t gets8() {
         int8_t q;
-        io->readObj(off, &q, 1);
-        off += 1;
+        fetch(&q, 1);
         return q;
     }
     uintmax_t getuint(size_t len) {
@@ -927,8 +1176,7 @@ public:
         uint8_t bytes[16];
         if (len > 16)
             throw Exception() << "can't deal with ints of size " << len;
-        io->readObj(off, bytes, len);
-        off += len;
+        fetch(bytes, len);
         uint8_t *p = bytes + len;
         for (size_t i = 1; i <= len; i++)
             rc = rc << 8 | p[-i];
@@ -939,8 +1187,7 @@ public:
         uint8_t bytes[16];
         if (len > 16 || len < 1)
             throw Exception() << "can't deal with ints of size " << len;
-        io->readObj(off, bytes, len);
-        off += len;
+        fetch(bytes, len);
         uint8_t *p = bytes + len;
         rc = (p[-1] & 0x80) ? -1 : 0;
         for (size_t i = 1; i <= len; i++)
@@ -949,12 +1196,16 @@ public:
     }
 
     uintmax_t getuleb128() {
-        auto v = io->readULEB128(off);
+        auto v = off < mem.size()
+           ? readleb128<uintmax_t>(reinterpret_cast<const unsigned char *>(mem.data()) + off)
+           : io->readULEB128(off);
         skip(v.second);
         return v.first;
     }
     intmax_t getsleb128() {
-        auto v = io->readSLEB128(off);
+        auto v = off < mem.size()
+           ? readleb128<intmax_t>(reinterpret_cast<const unsigned char *>(mem.data()) + off)
+           : io->readSLEB128(off);
         skip(v.second);
         return v.first;
     }
@@ -965,6 +1216,14 @@ public:
     intmax_t readFormSigned(Form f);
 
     std::string getstring() {
+        if (off < mem.size()) {
+            auto len = strnlen(mem.data() + off, mem.size() - off);
+            if (off + len < mem.size()) {
+                std::string s(mem.data() + off, len);
+                off += len + 1;
+                return s;
+            }
+        }
         std::string s = io->readString(off);
         off += s.size() + 1;
         return s;
@@ -0,0 +1,8 @@
+// From DWARFv5 section 7.19
+DWARF_IDX(DW_IDX_compile_unit, 1)
+DWARF_IDX(DW_IDX_type_unit, 2)
+DWARF_IDX(DW_IDX_die_offset, 3)
+DWARF_IDX(DW_IDX_parent, 4)
+DWARF_IDX(DW_IDX_type_hash, 5)
+DWARF_IDX(DW_IDX_lo_user, 0x2000)
+DWARF_IDX(DW_IDX_hi_user, 0x3fff)
@@ -39,8 +39,11 @@
 #include <string>
 #include <vector>
 #include <span>
+#include <atomic>
+#include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <utility>
 #include <variant>
@@ -70,6 +73,12 @@ typedef struct {
    Elf64_Xword ch_addralign;
 } Elf64_Chdr;
 #endif
+#ifndef ELFCOMPRESS_ZLIB
+#define ELFCOMPRESS_ZLIB 1
+#endif
+#ifndef ELFCOMPRESS_ZSTD // glibc before 2.37 lacks this.
+#define ELFCOMPRESS_ZSTD 2
+#endif
 
 namespace pstack::Elf {
 class Object;
@@ -131,6 +140,19 @@ roundup2(size_t val, size_t align)
 }
 #endif
 
+// The string hash used by .gnu.hash sections, also used to index symbol names.
+uint32_t gnuHash(std::string_view name) noexcept;
+
+// Read a T at off in a section, directly from its content if we have it.
+template <typename T> T readDirect(const Reader &r, std::span<const char> data, Off off) {
+    if (likely(off + sizeof (T) <= data.size())) {
+        T t;
+        memcpy(&t, data.data() + off, sizeof t);
+        return t;
+    }
+    return r.readObj<T>(off);
+}
+
 /*
  * SymHash provides symbol lookup via ".hash" section hashtable.
  */
@@ -140,14 +162,15 @@ class SymHash {
     Reader::csptr strings;
     Word nbucket;
     Word nchain;
-    std::vector<Word> data;
-    const Word *chains;
+    std::vector<Word> data; // copy of the table, if we can't use it in place.
     const Word *buckets;
+    const Word *chains;
+    std::span<const char> symData;
 public:
     static const char *tablename() { return ".hash"; }
     static int sectiontype() { return SHT_HASH; }
     SymHash(Reader::csptr hash_, Reader::csptr syms_, Reader::csptr strings_);
-    std::pair<uint32_t, Sym> findSymbol(const std::string &name); // fills sym, and returns index.
+    [[nodiscard]] std::pair<uint32_t, Sym> findSymbol(std::string_view name) const; // fills sym, and returns index.
 };
 
 /*
@@ -167,9 +190,14 @@ class GnuHash {
         uint32_t bloom_shift;
     };
     Header header;
+    // Direct access to the content of the sections, if available.
+    std::span<const char> hashData;
+    std::span<const char> symData;
     [[nodiscard]] uint32_t bloomoff(size_t idx) const noexcept { return sizeof header + idx * sizeof(Off); }
     [[nodiscard]] uint32_t bucketoff(size_t idx) const noexcept { return bloomoff(header.bloom_size) + idx * 4; }
     [[nodiscard]] uint32_t chainoff(size_t idx) const noexcept { return bucketoff(header.nbuckets) + idx * 4; }
+    // walk the hash chain for a name, once it has passed the bloom filter.
+    [[nodiscard]] std::pair<uint32_t, Sym> findInChain(std::string_view name, uint32_t symhash) const;
 public:
     static const char *tablename() noexcept { return ".gnu.hash"; }
     static int sectiontype() { return SHT_GNU_HASH; }
@@ -179,11 +207,15 @@ public:
         , syms(std::move(syms_))
         , strings(std::move(strings_))
         , header(hash->readObj<Header>(0))
+        , hashData(hash->span(0, hash->size()))
+        , symData(syms->span(0, syms->size()))
         {}
 
-    std::pair<uint32_t, Sym> findSymbol(const char *) const;
-    [[nodiscard]] std::pair<uint32_t, Sym> findSymbol(const std::string &name) const {
-       return findSymbol(name.c_str());
+    // false if no symbol with this hash is in the table.
+    [[nodiscard]] bool bloomMayContain(uint32_t symhash) const;
+    [[nodiscard]] std::pair<uint32_t, Sym> findSymbol(std::string_view name, uint32_t symhash) const;
+    [[nodiscard]] std::pair<uint32_t, Sym> findSymbol(std::string_view name) const {
+       return findSymbol(name, gnuHash(name));
     }
 };
 
@@ -193,6 +225,8 @@ public:
  */
 class Section {
     mutable Reader::csptr io_;
+    mutable std::once_flag ioOnce;
+    void makeIo() const;
 public:
     Shdr shdr;
     size_t index;
@@ -247,6 +281,7 @@ public:
     using iterator = ReaderArray<Sym>::iterator;
     iterator begin() { return array.begin(); }
     auto end() { return array.end(); }
+    size_t size() const { return symbols ? symbols->size() / sizeof (Sym) : 0; }
     Elf::Sym operator [] (size_t idx) const {
         return symbols->readObj<Sym>(idx * sizeof (Sym));
     }
@@ -254,7 +289,53 @@ public:
     SymbolSection(Reader::csptr symbols_, Reader::csptr strings_)
        : symbols(symbols_), strings(strings_), array(*symbols)
     {}
-    std::string name(const Sym &sym) const { return strings->readString(sym.st_name); }
+    std::string name(const Sym &sym) const {
+        auto direct = strings->stringView(sym.st_name);
+        return direct ? std::string(*direct) : strings->readString(sym.st_name);
+    }
+    // The name at an offset in the string table, if the table is in memory.
+    std::optional<std::string_view> nameView(Word nameOff) const {
+        return strings->stringView(nameOff);
+    }
+    // Compare the name at an offset in the string table, without copying it.
+    bool nameEquals(Word nameOff, std::string_view name) const {
+        return strings->stringEquals(nameOff, name);
+    }
+};
+
+// A hash index of the names in a symbol table, using open addressing. Slots
+// hold the hash of the name, and the index and name offset of the symbol -
+// names are compared in place in the string table, so building the index
+// copies no strings. Where names are duplicated, the last symbol wins.
+class SymbolNameIndex {
+    static constexpr uint32_t EMPTY = std::numeric_limits<uint32_t>::max();
+    struct Slot {
+        uint32_t hash;
+        uint32_t symIdx;
+        Word nameOff;
+    };
+    const SymbolSection &table;
+    std::vector<Slot> slots;
+    size_t mask;
+public:
+    explicit SymbolNameIndex(SymbolSection &table);
+    [[nodiscard]] std::optional<uint32_t> find(std::string_view name) const;
+};
+
+// An index of the symbols in a symbol table that can be found by address:
+// those with a non-zero size, in an allocated section. Entries are sorted by
+// start address, and stored as parallel arrays.
+class SymbolAddressIndex {
+    std::vector<Addr> starts;
+    std::vector<Addr> sizes;
+    std::vector<Addr> maxEnds; // the furthest end address of any entry up to this one.
+    std::vector<uint32_t> indices; // index of the symbol in its table.
+    std::vector<uint8_t> types;
+public:
+    SymbolAddressIndex(SymbolSection &table, const std::function<bool(const Sym &)> &include);
+    // The index in the table of the first symbol of type "type" (or any
+    // type, for STT_NOTYPE) that covers addr.
+    [[nodiscard]] std::optional<uint32_t> find(Addr addr, int type) const;
 };
 
 struct SymbolVersioning {
@@ -314,8 +395,11 @@ public:
     std::optional<std::pair<Sym, std::string>> findSymbolByAddress(Addr addr, int type);
 
     // Find symbols. The size_t field of the pair is the index within the symbol section
-    std::pair<Sym, size_t> findDynamicSymbol(const std::string &name);
-    std::pair<Sym, size_t> findDebugSymbol(const std::string &name);
+    std::pair<Sym, size_t> findDynamicSymbol(std::string_view name);
+    std::pair<Sym, size_t> findDebugSymbol(std::string_view name);
+    // Cheap prefilter for findDynamicSymbol, given the gnuHash of the name:
+    // false if the object definitely does not define the symbol.
+    [[nodiscard]] bool mayHaveDynamicSymbol(uint32_t gnuHash) const;
 
     // Misc operations
     std::string getInterpreter() const;
@@ -341,28 +425,37 @@ public:
 
 private:
     Ehdr elfHeader;
-    std::optional<std::pair<Sym, std::string>> findSym(auto &table, Addr addr, int type);
+    void loadDebug() const;
+    std::optional<std::pair<Sym, std::string>> findSym(SymbolSection &table,
+          std::unique_ptr<SymbolAddressIndex> &index, Addr addr, int type);
     // These are all caches of notionally const data.
     mutable std::unique_ptr<SymbolVersioning> symbolVersions_;
     mutable std::unique_ptr<SectionHeaders> sectionHeaders_;
+    mutable std::once_flag sectionHeadersOnce;
     mutable std::map<std::string, size_t> namedSection;
     mutable std::shared_ptr<Dynamic> dynamic_;
     mutable std::unique_ptr<SymbolSection> debugSymbols_;
     mutable std::unique_ptr<SymbolSection> dynamicSymbols_;
+    mutable std::once_flag debugSymbolsOnce;
+    mutable std::once_flag dynamicSymbolsOnce;
+    std::unique_ptr<SymbolAddressIndex> debugSymbolsByAddress_;
+    std::unique_ptr<SymbolAddressIndex> dynamicSymbolsByAddress_;
     mutable Object::sptr debugObject; // debug object as per .gnu_debuglink/other.
     mutable Object::sptr debugData_; // LZMA object in the original elf, .gnu_debugdata.
-    mutable bool debugLoaded; // We've at least attempted to load debugObject: don't try again
+    mutable std::once_flag debugLoaded; // We've at least attempted to load debugObject: don't try again
     mutable std::unique_ptr<SymHash> hash_; // Symbol hash table.
     mutable std::unique_ptr<GnuHash> gnu_hash_; // Enhanced GNU symbol hash table.
-    mutable const Phdr *lastSegmentForAddress; // cache of last segment returned for a specific address.
+    mutable std::atomic<const Phdr *> lastSegmentForAddress; // cache of last segment returned for a specific address.
 
     friend std::ostream &pstack::operator<< (std::ostream &, const pstack::JSON<Object> &);
 
-    // used to cache the debug symbol table by name. Popualted first time something requests such a symbol
-    std::unique_ptr<std::map<std::string, size_t>> cachedSymbols;
+    // Index of the debug symbol table by name. Populated first time something requests such a symbol
+    std::unique_ptr<SymbolNameIndex> debugSymbolsByName_;
+    std::once_flag debugSymbolsByNameOnce;
 
     ProgramHeadersByType programHeaders_;
-    SymbolSection &getSymtab(std::unique_ptr<SymbolSection> &table, const char *name, int type) const;
+    SymbolSection &getSymtab(std::unique_ptr<SymbolSection> &table, std::once_flag &once,
+          const char *name, int type) const;
     Dynamic &dynamic() const;
 
     const SectionHeaders &sectionHeaders() const;
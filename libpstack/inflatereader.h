@@ -2,6 +2,9 @@
 #define LIBPSTACK_INFLATEREADER_H
 #include "libpstack/reader.h"
 
+#include <memory>
+#include <vector>
+
 namespace pstack {
 
 bool zlibAvailable();
@@ -17,6 +20,39 @@ public:
     const char *data() const override { return data_.data(); }
     InflateReader(size_t inflatedSize, const Reader &upstream);
 };
-}
+
+// A Reader that inflates the underlying reader lazily, for compressed content
+// too large to inflate up front. As we inflate, we record a checkpoint every
+// checkpointInterval bytes of output, at a deflate block boundary: the input
+// position, and the 32KiB window preceding it. Reads then only inflate from
+// the nearest checkpoint before them, and ChunkedReader keeps the most
+// recently inflated content.
+class StreamingInflateReader : public ChunkedReader {
+    StreamingInflateReader(const StreamingInflateReader &) = delete;
+    StreamingInflateReader() = delete;
+    struct Checkpoint {
+        Off out; // offset in the inflated content.
+        Off in; // bytes of input consumed.
+        int bits; // bits of the last byte consumed still to be used.
+        std::vector<unsigned char> window;
+    };
+    struct Stream;
+    Reader::csptr upstream;
+    const size_t inflatedSize;
+    const Off checkpointInterval;
+    mutable std::vector<Checkpoint> checkpoints; // sorted by "out".
+    mutable std::unique_ptr<Stream> stream;
+
+    void decodeChunk(Off chunkOffset) const override;
+public:
+    StreamingInflateReader(size_t inflatedSize, Reader::csptr upstream,
+          Off checkpointInterval = 4 * 1024 * 1024, size_t cacheBytes = 32 * 1024 * 1024);
+    ~StreamingInflateReader();
+    void describe(std::ostream &) const override;
+    Off size() const override { return inflatedSize; }
+    std::string filename() const override { return upstream->filename(); }
+    // checkpoints recorded so far, including the one at the start.
+    size_t checkpointCount() const;
+};}
 
 #endif // LIBPSTACK_INFLATEREADER_H
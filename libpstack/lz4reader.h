@@ -2,13 +2,27 @@
 #define LIBPSTACK_LZ4READER_H
 #include "libpstack/reader.h"
 
+#include <filesystem>
+#include <future>
+#include <list>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
 #include <vector>
 
 namespace pstack {
 /*
  * Provides an Lz4-decoded view of downstream.
- * official lz4 frame format won't provide random access information, so we have to sparsely scan the whole file first.
- * TODO: produce lz4 frame with random access index with the "Skippable Frames", and use them to avoid the full scan.
+ * official lz4 frame format won't provide random access information, so we have to sparsely scan the whole file first,
+ * unless the lz4 frame is followed by a skippable frame holding our block index, as appended by appendIndex().
+ *
+ * The index frame, all fields little-endian:
+ *   u32 skippable frame magic (0x184d2a5c), u32 size of the rest of the frame,
+ *   u32 index version, u32 max block size, u64 block count, u64 decompressed size,
+ *   per block: u64 offset of the block data, u32 block size word as in the lz4 frame, u32 decompressed size,
+ *   u32 size of the whole index frame, u32 index magic.
+ * The trailing size and magic let us find the index from the end of the file. If the index doesn't check out, we
+ * ignore it, and scan the blocks.
  */
 class Lz4Reader : public Reader {
     Lz4Reader(const Lz4Reader &) = delete;
@@ -19,8 +33,6 @@ class Lz4Reader : public Reader {
     bool with_content_checksum_ = false;
     bool with_dic_id_ = false;
     size_t max_block_size_ = 0;
-    mutable std::vector<char> block_buf_, decompressed_buf_;
-    mutable size_t decompressed_buf_blk_id_ = std::numeric_limits<size_t>::max();
     struct BlockInfo {
         bool uncompressed_;
         size_t data_size_;
@@ -28,16 +40,57 @@ class Lz4Reader : public Reader {
     };
     std::vector<BlockInfo> blocks_;
     size_t decompressed_size_ = 0;
+    Off frame_end_ = 0; // end of the lz4 frame: start of our index frame, if there is one.
+    bool indexed_ = false;
+
+    // decompressed blocks, kept in an LRU list up to a memory budget. When
+    // blocks are read in sequence, the next few are decompressed ahead of
+    // the reader on worker threads.
+    using DecompressedBlock = std::shared_ptr<const std::vector<char>>;
+    struct CachedBlock {
+        DecompressedBlock data_;
+        std::list<size_t>::iterator lru_pos_;
+    };
+    size_t cache_budget_;
+    size_t prefetch_blocks_;
+    mutable std::mutex cache_lock_;
+    mutable std::list<size_t> lru_; // most recently used first.
+    mutable std::unordered_map<size_t, CachedBlock> cache_;
+    mutable size_t cached_bytes_ = 0;
+    mutable std::unordered_map<size_t, std::shared_future<DecompressedBlock>> in_flight_;
+    mutable size_t last_blk_idx_ = std::numeric_limits<size_t>::max();
+    mutable size_t sequential_run_ = 0;
+
 public:
-    Lz4Reader(Reader::csptr upstream);
+    static constexpr size_t kDefaultCacheBudget = Options::defaultLz4CacheSize;
+    static constexpr size_t kDefaultPrefetchBlocks = 4;
+    // cache_budget is the bytes of decompressed blocks to keep, and
+    // prefetch_blocks how many blocks to decompress ahead of sequential reads.
+    Lz4Reader(Reader::csptr upstream, size_t cache_budget = kDefaultCacheBudget,
+          size_t prefetch_blocks = kDefaultPrefetchBlocks);
     ~Lz4Reader();
     size_t read(Off, size_t, char *) const override;
     void describe(std::ostream &) const override;
     Off size() const override;
     std::string filename() const override { return upstream_->filename(); }
 
+    // true if the blocks were found from an index rather than by scanning.
+    bool indexed() const { return indexed_; }
+    // bytes of decompressed blocks in the cache.
+    size_t cached_bytes() const;
+    // write the index frame for this file's blocks.
+    void write_index(std::ostream &) const;
+    // append an index frame to the lz4 file at path, if it doesn't already have one.
+    static void appendIndex(Context &, const std::filesystem::path &);
+
 private:
+    bool load_index(Off frame_data_offset);
+    void scan_blocks(Off offset);
     bool decompress_block(size_t, Off, size_t, char*) const;
+    DecompressedBlock decompress_block_data(size_t) const;
+    DecompressedBlock get_block(size_t) const;
+    void cache_block(size_t, DecompressedBlock) const;
+    void prefetch_after(size_t) const;
     bool read_upstream_up_to(Off, size_t, char*) const;
 };
 }
@@ -4,8 +4,10 @@
 #include <signal.h>
 #include <memory.h>
 
+#include <array>
 #include <map>
 #include <set>
+#include <shared_mutex>
 #include <stack>
 #include <functional>
 #include <optional>
@@ -128,6 +130,34 @@ public:
     [[nodiscard]] Dwarf::Info::sptr dwarf() const { return codeloc ? codeloc->dwarf() : nullptr; }
 };
 
+// A precomputed way to unwind through one row of an FDE's unwind table, for
+// the common shapes of frame: the CFA is the stack or frame pointer plus an
+// offset, and everything restored is a general purpose register saved
+// relative to the CFA. Anything else uses the full DWARF unwinder.
+struct UnwindPlan {
+    enum Kind : uint8_t {
+        GENERIC, // use the full DWARF unwinder.
+        CFA_SP,  // CFA is the stack pointer plus cfaOffset.
+        CFA_FP,  // CFA is the frame pointer plus cfaOffset.
+    };
+    static constexpr size_t MAXSAVED = 12;
+    Kind kind { GENERIC };
+    uint8_t savedCount {};
+    int32_t cfaOffset {};
+    std::array<std::pair<uint8_t, int32_t>, MAXSAVED> saved {}; // register, offset from CFA.
+};
+
+// The plans for each row of an FDE's unwind table, as loaded in a process.
+struct UnwindPlans {
+    Elf::Addr end; // process address of the end of the FDE's range.
+    Elf::Addr elfReloc;
+    Dwarf::Info::sptr dwarf; // keeps the FDE's table alive.
+    const Dwarf::UnwindTable *table;
+    int rar;
+    bool isSignalHandler;
+    std::vector<UnwindPlan> plans; // one for each of table's rows.
+};
+
 class StackFrame {
 public:
     [[nodiscard]] gpreg rawIP() const;
@@ -246,6 +276,17 @@ class Process : public ps_prochandle {
     Elf::Addr vdsoBase{};
     Elf::Addr execBase{};
     void loadSharedObjects(Elf::Addr);
+    Stacks getStacksFromSnapshot();
+    Stacks unwindStacks(const std::map<lwpid_t, CoreRegisters> &);
+    void prefetchObjects();
+    void addThreadInfo(Stacks &);
+    std::mutex objectLock; // serializes lazy loading of objects' images.
+    // Memoized results of resolveSymbolDetail by name, without [0] and with
+    // [1] debug symbols. Each records the first object defining the symbol,
+    // or that no object does. Cleared when the set of objects changes.
+    using ResolvedSymbol = std::tuple<Elf::Object::sptr, Elf::Addr, Elf::Sym>;
+    std::array<std::map<std::string, std::optional<ResolvedSymbol>, std::less<>>, 2> resolvedSymbols;
+    std::mutex resolvedSymbolsLock;
     Elf::Addr extractDtDebugFromDynamicSegment(const Elf::Phdr &phdr, Elf::Addr loadAddr, const char *);
     void processAUXV(const Reader &);
 
@@ -259,6 +300,10 @@ protected:
 public:
     [[nodiscard]] Elf::Addr getVdsoBase() const { return vdsoBase; };
     std::map<Elf::Addr, MappedObject> objects;
+    // Unwind plans for FDEs we've unwound through, keyed by the process
+    // address at the start of each FDE.
+    std::map<Elf::Addr, UnwindPlans> unwindPlans;
+    std::shared_mutex unwindPlanLock;
     Elf::Object::sptr execImage;
     Elf::Object::sptr vdsoImage;
     Context &context;
@@ -343,9 +388,24 @@ public:
     LiveReader(Context &, pid_t, const std::string &);
 };
 
+// Reads the memory of a live process with process_vm_readv rather than
+// through /proc/<pid>/mem. Batched reads of discontiguous ranges need only a
+// single system call.
+class ProcessVmReader : public Reader {
+    pid_t pid;
+public:
+    size_t read(Off off, size_t count, char *ptr) const override;
+    void readv(std::span<Segment> segments) const override;
+    void describe(std::ostream &os) const override { os << "memory of process " << pid; }
+    std::string filename() const override;
+    Off size() const override { return std::numeric_limits<Off>::max(); }
+    explicit ProcessVmReader(pid_t pid_) : pid(pid_) {}
+};
+
 struct LiveThreadList;
 class LiveProcess : public Process {
     pid_t pid;
+    std::shared_ptr<CacheReader> cache; // flushed when the process is resumed.
 
     struct Lwp {
         int stopCount = 0;
@@ -400,6 +460,24 @@ protected:
     [[nodiscard]] std::vector<AddressRange> addressSpace() const override;
 };
 
+// A copy of some ranges of another reader's content, taken at a specific
+// point in time. We use this to capture the stacks of a live process, so we
+// can resume it before doing the expensive work of unwinding them. Reads
+// outside the captured ranges go to the upstream reader.
+class SnapshotReader final : public Reader {
+    Reader::sptr upstream_;
+    std::map<Off, std::vector<char>> ranges; // keyed by start offset.
+public:
+    explicit SnapshotReader(Reader::sptr upstream) : upstream_(std::move(upstream)) {}
+    // copy the content of each (offset, size) range from upstream.
+    void capture(const std::vector<std::pair<Off, size_t>> &ranges);
+    size_t read(Off off, size_t count, char *ptr) const override;
+    void describe(std::ostream &os) const override { os << *upstream_; }
+    std::string filename() const override { return upstream_->filename(); }
+    Off size() const override { return upstream_->size(); }
+    const Reader::sptr &upstream() const { return upstream_; }
+};
+
 class CoreProcess;
 class CoreReader final : public Reader {
     Process *p;
@@ -8,6 +8,12 @@
 #include <limits>
 #include <list>
 #include <array>
+#include <vector>
+#include <span>
+#include <string_view>
+#include <optional>
+#include <mutex>
+#include <cstring>
 #include "libpstack/exception.h"
 #include "libpstack/context.h"
 
@@ -51,6 +57,21 @@ public:
     // read a sequence of count bytes at offset off. May give a short return.
     virtual size_t read(Off off, size_t count, char *ptr) const = 0;
 
+    // One of a batch of reads passed to readv. "rc" is filled in with the
+    // number of bytes actually read into ptr.
+    struct Segment {
+        Off off;
+        size_t count;
+        char *ptr;
+        size_t rc;
+    };
+
+    // Read a batch of (possibly discontiguous) ranges. Readers that can
+    // service many ranges with a single system call override this. Failure
+    // to read a segment, in whole or in part, is reflected in its rc, rather
+    // than by an exception.
+    virtual void readv(std::span<Segment> segments) const;
+
     // read a LEB128 encoded integer.
     virtual std::pair<uintmax_t, size_t> readULEB128(Off off) const;
     virtual std::pair<intmax_t, size_t> readSLEB128(Off off) const;
@@ -64,6 +85,19 @@ public:
     // read a text string at an offset
     virtual std::string readString(Off offset) const;
 
+    // If the bytes at [off, off + count) are held contiguously in memory,
+    // return them directly, clipped to the end of the reader. Readers
+    // without direct access to their content return an empty span, and the
+    // caller must fall back to read(). The span remains valid for the
+    // lifetime of the reader.
+    virtual std::span<const char> span(Off, size_t) const { return {}; }
+
+    // As for span, but for a NUL-terminated string at off.
+    std::optional<std::string_view> stringView(Off off) const;
+
+    // Compare the NUL-terminated string at off with name, without allocating.
+    bool stringEquals(Off off, std::string_view name) const;
+
     virtual Off size() const = 0;
     typedef std::shared_ptr<Reader> sptr;
     typedef std::shared_ptr<const Reader> csptr;
@@ -104,6 +138,7 @@ protected:
     mutable Off fileSize;
 public:
     virtual size_t read(Off off, size_t count, char *ptr) const override ;
+    void readv(std::span<Segment> segments) const override;
     FileReader(Context &, const std::string &name_);
     FileReader(Context &, const std::string &name_, int fd);
     ~FileReader();
@@ -115,33 +150,101 @@ public:
 // Reader implementations
 
 class CacheReader final : public Reader {
+public:
+    // Tuning parameters for the cache. The reader stacks we cache have quite
+    // different access patterns - live process memory sees small scattered
+    // reads over stacks and heap structures, while core files and other
+    // plain files are often scanned sequentially - so each stack picks its
+    // own configuration.
+    struct Config {
+        size_t pageSize;     // bytes per cached page.
+        size_t maxBytes;     // total capacity of the cache, in bytes.
+        size_t maxReadahead; // largest upstream read issued for sequential misses.
+    };
+    static const Config defaultConfig;
+    static const Config liveMemoryConfig; // /proc/<pid>/mem and the like.
+    static const Config fileConfig;       // core files, and other large files.
+
+private:
     Reader::csptr upstream;
+    // Guards all the cache state below: a reader can be shared by threads
+    // unwinding different stacks.
+    mutable std::mutex cacheLock;
     mutable std::unordered_map<Off, std::string> stringCache;
-    static const size_t PAGESIZE = 256;
-    static const size_t MAXPAGES = 16;
-    class Page {
-    public:
+    const size_t pageSize;
+    const size_t maxPages;
+    const size_t maxReadaheadPages;
+    struct Page {
         Off offset;
         size_t len;
-        std::array<char, PAGESIZE> data;
-        void load(const Reader &r, Off offset_);
+        std::unique_ptr<char[]> data;
     };
-    mutable std::list<std::unique_ptr<Page>> pages;
-    Page &getPage(Off pageoff) const;
+    using PageList = std::list<Page>;
+    mutable PageList pages; // most recently used page at the front.
+    mutable std::unordered_map<Off, PageList::iterator> pageIndex;
+
+    // Sequential access detection: if we miss on the page immediately
+    // following the last run of pages we loaded, double the number of pages
+    // we fetch on the next miss, up to maxReadaheadPages.
+    mutable Off nextSequential = std::numeric_limits<Off>::max();
+    mutable size_t readahead = 1;
+    mutable std::vector<char> readaheadBuf;
+
+    Page &allocPage(Off pageoff) const;
+    const Page &getPage(Off pageoff) const;
+    size_t readCached(Off off, size_t count, char *ptr) const; // with cacheLock held.
 public:
     void flush();
     size_t read(Off off, size_t count, char *ptr) const override;
+    void readv(std::span<Segment> segments) const override;
     void describe(std::ostream &os) const override {
         // this must be the same as the underlying stream: we sometimes rely on the
         // FileReader's filename
         os << *upstream;
     }
-    explicit CacheReader(Reader::csptr upstream_);
+    explicit CacheReader(Reader::csptr upstream_, const Config &config = defaultConfig);
     std::string readString(Off off) const override;
     Off size() const override { return upstream->size(); }
     std::string filename() const override { return upstream->filename(); }
 };
 
+// Base for readers whose content has to be produced by decoding upstream
+// data in sequence, like the streaming decompressors. Decoded content is held
+// in an LRU cache of chunks, so memory use is bounded by the cache budget
+// rather than the decoded size. On a miss, the subclass's decodeChunk
+// decodes until the chunk is available, calling addChunk with each chunk it
+// completes on the way.
+class ChunkedReader : public Reader {
+protected:
+    struct Chunk {
+        Off offset;
+        std::vector<char> data;
+    };
+    const size_t chunkSize;
+    // Guards the chunk cache, and the subclass's decoder state: chunkStart
+    // and decodeChunk are called with it held.
+    mutable std::mutex lock;
+
+    ChunkedReader(size_t chunkSize, size_t cacheBytes);
+    void addChunk(Off offset, std::vector<char> &&data) const;
+    // The offset of the chunk that holds "offset".
+    virtual Off chunkStart(Off offset) const { return offset / chunkSize * chunkSize; }
+    // Decode until the chunk starting at chunkOffset is in the cache.
+    virtual void decodeChunk(Off chunkOffset) const = 0;
+
+private:
+    const size_t maxChunks;
+    mutable std::list<Chunk> chunks; // most recently used first.
+    mutable std::unordered_map<Off, std::list<Chunk>::iterator> chunkIndex;
+    const Chunk &getChunk(Off offset) const;
+
+public:
+    size_t read(Off off, size_t count, char *ptr) const override;
+    // Decoded section content, so offset 0 is a real string, unlike
+    // Reader's default.
+    std::string readString(Off off) const override;
+};
+
 class AbstractMemReader : public Reader {
 protected:
     std::string descr;
@@ -153,6 +256,7 @@ public:
     csptr view(const std::string &name, Off start, Off length=std::numeric_limits<Off>::max()) const override;
     std::pair<uintmax_t, size_t> readULEB128(Off off) const override;
     std::pair<intmax_t, size_t> readSLEB128(Off off) const override;
+    std::span<const char> span(Off off, size_t count) const override;
     AbstractMemReader(const std::string &name);
     virtual const char *data() const = 0;
 };
@@ -205,6 +309,7 @@ public:
         return upstream->readString(absoff + offset);
     }
     size_t read(Off off, size_t count, char *ptr) const override;
+    void readv(std::span<Segment> segments) const override;
     OffsetReader(std::string, Reader::csptr upstream_, Off offset_, Off length_ = std::numeric_limits<Off>::max());
     void describe(std::ostream &os) const override {
         os << name << " [" << offset << "," << offset + length << "] of " << *upstream;
@@ -212,6 +317,12 @@ public:
     Off size() const override;
     std::string filename() const override { return upstream->filename(); }
 
+    std::span<const char> span(Off off, size_t count) const override {
+        if (off >= length)
+            return {};
+        return upstream->span(off + offset, std::min(Off(count), length - off));
+    }
+
     // Implement "view" on the parent with our offset added.
     Reader::csptr view( const std::string &name, Off offset_, Off size) const override {
        return upstream->view( name, offset + offset_, size );
@@ -233,6 +344,7 @@ class ReaderArray {
    mutable size_t cacheEnd = 0; // after last valid item in cache.
    mutable size_t eof;
    mutable std::array<T, cachesize> cache;
+   const T *direct = nullptr; // if the reader's content is in memory, and suitably aligned.
 
 public:
    class iterator;
@@ -288,6 +400,11 @@ public:
       if(reader.size() != std::numeric_limits<size_t>::max() && reader.size() % sizeof (T) != 0) {
          throw ( Exception() << "end of data while reading array" );
       }
+      if (eof != 0 && reader.size() != std::numeric_limits<size_t>::max()) {
+         auto mem = reader.span(base, eof * sizeof (T));
+         if (mem.size() == eof * sizeof (T) && reinterpret_cast<uintptr_t>(mem.data()) % alignof(T) == 0)
+            direct = reinterpret_cast<const T *>(mem.data());
+      }
    }
 };
 template <typename T, size_t sz>
@@ -303,6 +420,11 @@ typename ReaderArray<T, cachesize>::iterator &ReaderArray<T, cachesize>::iterato
 #define unlikely(x)     __builtin_expect(!!(x), 0)
 
 template <typename T, size_t cachesize> const T &ReaderArray<T, cachesize>::getitem(size_t idx) const {
+   if (likely(direct != nullptr)) {
+      if (unlikely(idx >= eof))
+         throw ( Exception() << "end of data while reading array" );
+      return direct[idx];
+   }
    if (unlikely(cacheStart > idx || idx >= cacheEnd)) {
       size_t rc = reader.read(idx * sizeof(T) + base, cachesize * sizeof (T), reinterpret_cast<char *>(cache.data()));
       cacheStart = idx;
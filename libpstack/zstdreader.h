@@ -0,0 +1,116 @@
+#ifndef LIBPSTACK_ZSTDREADER_H
+#define LIBPSTACK_ZSTDREADER_H
+
+#include <map>
+#include <memory>
+#include <vector>
+#include "libpstack/reader.h"
+
+namespace pstack {
+
+bool zstdAvailable();
+
+// true if the libzstd we loaded is a release ZstdReader knows how to copy
+// the decoder of, so it can checkpoint within frames.
+bool zstdCheckpointsAvailable();
+
+// true if the content of the reader starts with a zstd frame.
+bool isZstd(const Reader &);
+
+// true if the zstd frame at the start of the reader has a window smaller
+// than its content, and zstdCheckpointsAvailable(), so ZstdReader can
+// checkpoint it.
+bool zstdCanCheckpoint(const Reader &);
+
+// A Reader holding all of the zstd-decoded content of upstream, which must
+// decode to decompressedSize bytes. For small compressed ELF sections.
+class ZstdMemReader : public AbstractMemReader {
+    std::vector<char> data_;
+    ZstdMemReader(const ZstdMemReader &) = delete;
+    ZstdMemReader() = delete;
+public:
+    Off size() const override { return data_.size(); }
+    const char *data() const override { return data_.data(); }
+    ZstdMemReader(size_t decompressedSize, const Reader &upstream);
+};
+
+/*
+ * Provides a zstd-decoded view of downstream. libzstd is loaded at runtime.
+ *
+ * zstd frames are independent of each other, so the frames are our unit of
+ * random access. Files in the zstd seekable format carry a seek table listing
+ * each frame's compressed and decompressed sizes, and we just read that.
+ * Otherwise, we find the frames on the first pass by walking the frame and
+ * block headers, only decompressing frames that don't record their size.
+ *
+ * Within a frame, we use libzstd's buffer-less API, where the decoded data
+ * the decoder refers back to stays in our own buffers. That lets us record a
+ * checkpoint every checkpointInterval bytes of a frame, at a block boundary:
+ * a copy of the decoder's context, and the decoded data preceding it, at
+ * least a window's worth. Reads then only decode from the nearest checkpoint
+ * before them. Checkpoints are recorded the first time we decode through a
+ * part of a frame, including when scanning frames without a content size.
+ * The checkpoints together hold at most checkpointBudget bytes: when another
+ * would take them over that, we drop every other one, and double the
+ * interval, so a long stream ends up with fewer, more widely spaced ones.
+ * A frame whose window is its whole content (small frames, normally) can't be
+ * checkpointed, and is decoded from its start. Copying the decoder relies on
+ * the layout of libzstd's private context, so with releases of libzstd we
+ * haven't checked that for, no frame is checkpointed.
+ *
+ * Decoded content is held in chunks relative to the start of each frame,
+ * cached by ChunkedReader.
+ */
+class ZstdReader : public ChunkedReader {
+    ZstdReader(const ZstdReader &) = delete;
+    ZstdReader() = delete;
+    struct Frame {
+        Off compressedOffset;
+        Off compressedSize;
+        Off decompressedOffset;
+        Off decompressedSize;
+    };
+    struct Checkpoint;
+    struct Decoder;
+    Reader::csptr upstream;
+    mutable Off checkpointInterval; // at least doubled each time we thin the checkpoints.
+    const size_t checkpointBudget;
+    mutable size_t checkpointBytes = 0; // held by the checkpoints.
+    std::vector<Frame> frames; // sorted by decompressedOffset.
+    Off decompressedSize = 0;
+    bool seekable = false;
+    // indexed by offset in the decoded content.
+    mutable std::map<Off, Checkpoint> checkpoints;
+    mutable std::unique_ptr<Decoder> decoder;
+
+    bool loadSeekTable();
+    void scanFrames();
+    std::vector<Frame>::const_iterator frameAt(Off offset) const;
+    Off windowSize(const Frame &) const;
+    std::map<Off, Checkpoint>::const_iterator lastCheckpoint(const Frame &, Off offset) const;
+    Off nextCheckpointAfter(const Frame &, Off offset) const;
+    void addCheckpoint(const Frame &, Off offset) const;
+    void thinCheckpoints() const;
+    Off chunkStart(Off offset) const override;
+    void decodeChunk(Off chunkOffset) const override;
+    // decode from the current position in "frame" until chunk "until" is
+    // complete, caching the chunks we pass. Returns the frame's total
+    // decompressed size if we reach its end.
+    Off decodeFrame(size_t frame, Off until) const;
+public:
+    ZstdReader(Reader::csptr upstream, Off checkpointInterval = 4 * 1024 * 1024,
+          size_t cacheBytes = 64 * 1024 * 1024, size_t checkpointBudget = 256 * 1024 * 1024);
+    ~ZstdReader();
+    void describe(std::ostream &) const override;
+    Off size() const override { return decompressedSize; }
+    std::string filename() const override { return upstream->filename(); }
+    // checkpoints recorded so far, not including the start of each frame.
+    size_t checkpointCount() const;
+    // bytes the checkpoints hold, at most checkpointBudget.
+    size_t checkpointMemory() const;
+    bool isSeekable() const { return seekable; }
+};
+
+}
+
+#endif
@@ -5,6 +5,7 @@
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include <proc_service.h>
 #include <dirent.h>
@@ -25,19 +26,136 @@ LiveReader::LiveReader(Context &c, pid_t pid, const std::string &base) : FileRea
    fileSize = std::numeric_limits<Reader::Off>::max();
 }
 
+namespace {
+// Read a batch of segments with as few process_vm_readv calls as we can. The
+// kernel stops transferring at the first remote range it cannot read, so
+// after a short transfer, we pick up again after the range that failed.
+// Returns 0, or the errno from the first call that failed outright.
+int
+vmReadv(pid_t pid, std::span<Reader::Segment> segments)
+{
+    std::vector<iovec> local;
+    std::vector<iovec> remote;
+    int err = 0;
+    for (size_t start = 0; start < segments.size(); ) {
+        size_t end = std::min(segments.size(), start + IOV_MAX);
+        local.clear();
+        remote.clear();
+        for (size_t i = start; i < end; ++i) {
+            local.push_back({ segments[i].ptr, segments[i].count });
+            remote.push_back({ reinterpret_cast<void *>(segments[i].off), segments[i].count });
+        }
+        auto rc = process_vm_readv(pid, local.data(), local.size(), remote.data(), remote.size(), 0);
+        if (rc == -1) {
+            if (err == 0)
+                err = errno;
+            if (errno != EFAULT) {
+                // Not a problem with the addresses - nothing else will work either.
+                for (size_t i = start; i < segments.size(); ++i)
+                    segments[i].rc = 0;
+                break;
+            }
+            segments[start++].rc = 0;
+            continue;
+        }
+        size_t i = start;
+        for (; i < end; ++i) {
+            segments[i].rc = std::min(size_t(rc), segments[i].count);
+            rc -= segments[i].rc;
+            if (segments[i].rc != segments[i].count)
+                break;
+        }
+        start = i == end ? end : i + 1;
+    }
+    return err;
+}
+}
+
+size_t
+ProcessVmReader::read(Off off, size_t count, char *ptr) const
+{
+    Segment seg { off, count, ptr, 0 };
+    int err = vmReadv(pid, { &seg, 1 });
+    if (seg.rc == 0 && count != 0)
+        throw (Exception()
+            << "read " << count
+            << " at " << (void *)off
+            << " on " << *this
+            << " failed: " << strerror(err));
+    return seg.rc;
+}
+
+void
+ProcessVmReader::readv(std::span<Segment> segments) const
+{
+    vmReadv(pid, segments);
+}
+
+std::string
+ProcessVmReader::filename() const
+{
+    return "/proc/" + std::to_string(pid) + "/mem";
+}
+
+namespace {
+// Create the reader for a live process's memory, as selected by the context's
+// options. process_vm_readv may not be usable (eg, it's disallowed by a
+// seccomp filter in a container), so in automatic mode, we test it by
+// reading the target's program headers, falling back to /proc/<pid>/mem.
+Reader::sptr
+liveMemory(Context &context, pid_t pid)
+{
+    bool useVm = false;
+    switch (context.options.liveMemory) {
+        case LiveMemory::PROCFS:
+            break;
+        case LiveMemory::VMREADV:
+            useVm = true;
+            break;
+        case LiveMemory::AUTO:
+            try {
+                LiveReader auxv(context, pid, "auxv");
+                for (auto &aux : ReaderArray<Elf::auxv_t>(auxv)) {
+                    if (aux.a_type == AT_NULL)
+                        break;
+                    if (aux.a_type == AT_PHDR) {
+                        char probe;
+                        Reader::Segment seg { aux.a_un.a_val, sizeof probe, &probe, 0 };
+                        ProcessVmReader(pid).readv({ &seg, 1 });
+                        useVm = seg.rc == sizeof probe;
+                        break;
+                    }
+                }
+            }
+            catch (const Exception &ex) {
+                if (context.verbose > 0)
+                    *context.debug << "can't probe process_vm_readv for " << pid << ": " << ex.what() << "\n";
+            }
+            break;
+    }
+    if (context.verbose > 0)
+        *context.debug << "reading memory of process " << pid << " with "
+            << (useVm ? "process_vm_readv" : "/proc/<pid>/mem") << "\n";
+    if (useVm)
+        return std::make_shared<ProcessVmReader>(pid);
+    return std::make_shared<LiveReader>(context, pid, "mem");
+}
+}
+
 Elf::Object::sptr
 LiveProcess::executableImage() {
    return context.findImage(context.procname(getPID(), "exe"));
 }
 
 LiveProcess::LiveProcess(Context &context, Elf::Object::sptr &ex, pid_t pid_, bool alreadyStopped)
-    : LiveProcess(context, ex, pid_, std::make_shared<CacheReader>(std::make_shared<LiveReader>(context, pid_, "mem")), alreadyStopped)
+    : LiveProcess(context, ex, pid_, std::make_shared<CacheReader>(liveMemory(context, pid_), CacheReader::liveMemoryConfig), alreadyStopped)
 {
 }
 
 LiveProcess::LiveProcess(Context &context, Elf::Object::sptr &ex, pid_t pid_, Reader::sptr memory, bool alreadyStopped)
     : Process( context, ex, memory )
     , pid(pid_)
+    , cache(std::dynamic_pointer_cast<CacheReader>(memory))
 {
     if (alreadyStopped)
        stoppedLWPs[pid].stopCount = 1;
@@ -71,7 +189,8 @@ LiveProcess::resume(lwpid_t lwpid) {
    }
    if (ptrace(PT_DETACH, lwpid, caddr_t(1), 0) != 0 && context.debug != nullptr)
       *context.debug << "failed to detach from process " << lwpid << ": " << strerror(errno) << "\n";
-   dynamic_cast<CacheReader&>(*io).flush();
+   if (cache)
+      cache->flush();
    if (context.verbose >= 1) {
       timeval tv;
       gettimeofday(&tv, nullptr);
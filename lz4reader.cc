@@ -4,9 +4,19 @@
 #include <lz4.h>
 
 #include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
 
 namespace
 {
+    constexpr uint32_t kSkippableMagic = 0x184d2a5c;
+    constexpr uint32_t kIndexMagic = 0x58493450; // "P4IX"
+    constexpr uint32_t kIndexVersion = 1;
+    constexpr size_t kIndexHeaderSize = 32;
+    constexpr size_t kIndexEntrySize = 16;
+    constexpr size_t kIndexTrailerSize = 8;
+
     template<typename T>
     T FetchAdd(T &offset, size_t incre)
     {
@@ -18,8 +28,10 @@ namespace
 
 namespace pstack
 {
-    Lz4Reader::Lz4Reader(Reader::csptr upstream)
+    Lz4Reader::Lz4Reader(Reader::csptr upstream, size_t cache_budget, size_t prefetch_blocks)
         : upstream_{std::move(upstream)}
+        , cache_budget_{cache_budget}
+        , prefetch_blocks_{prefetch_blocks}
     {
         Off offset = 0;
         uint32_t magic;
@@ -62,8 +74,6 @@ namespace pstack
         {
             return;
         }
-        block_buf_.resize(max_block_size_);
-        decompressed_buf_.resize(max_block_size_);
         if (with_content_size_)
         {
             // should be not
@@ -75,6 +85,87 @@ namespace pstack
         }
         offset += 1; // header checksum
 
+        if (!load_index(offset))
+        {
+            scan_blocks(offset);
+        }
+    }
+
+    bool Lz4Reader::load_index(Off frame_data_offset)
+    {
+        const Off file_size = upstream_->size();
+        if (file_size < frame_data_offset + kIndexHeaderSize + kIndexTrailerSize)
+        {
+            return false;
+        }
+        uint32_t trailer[2];
+        upstream_->readObj(file_size - sizeof trailer, trailer, 2);
+        const Off index_size = le32toh(trailer[0]);
+        if (le32toh(trailer[1]) != kIndexMagic || index_size > file_size - frame_data_offset
+            || index_size < kIndexHeaderSize + kIndexTrailerSize)
+        {
+            return false;
+        }
+        // whatever happens now, the lz4 frame ends where the index frame starts.
+        frame_end_ = file_size - index_size;
+
+        unsigned char header[kIndexHeaderSize];
+        if (!read_upstream_up_to(frame_end_, sizeof header, reinterpret_cast<char *>(header)))
+        {
+            return false;
+        }
+        auto get32 = [](const unsigned char *p) { uint32_t v; memcpy(&v, p, sizeof v); return le32toh(v); };
+        auto get64 = [](const unsigned char *p) { uint64_t v; memcpy(&v, p, sizeof v); return le64toh(v); };
+        const uint64_t block_count = get64(header + 16);
+        if (get32(header) != kSkippableMagic || get32(header + 4) != index_size - 8
+            || get32(header + 8) != kIndexVersion || get32(header + 12) != max_block_size_
+            || block_count != (index_size - kIndexHeaderSize - kIndexTrailerSize) / kIndexEntrySize
+            || index_size != kIndexHeaderSize + block_count * kIndexEntrySize + kIndexTrailerSize)
+        {
+            return false;
+        }
+
+        std::vector<unsigned char> entries(block_count * kIndexEntrySize);
+        if (!read_upstream_up_to(frame_end_ + kIndexHeaderSize, entries.size(), reinterpret_cast<char *>(entries.data())))
+        {
+            return false;
+        }
+        std::vector<BlockInfo> blocks;
+        blocks.reserve(block_count);
+        size_t decompressed_size = 0;
+        for (uint64_t i = 0; i < block_count; ++i)
+        {
+            const unsigned char *entry = entries.data() + i * kIndexEntrySize;
+            const uint32_t block_size = get32(entry + 8);
+            const uint32_t block_decompressed_size = get32(entry + 12);
+            BlockInfo blk_info {
+                .uncompressed_ = (block_size >> 31) ? true : false,
+                .data_size_ = block_size & 0x7fffffff,
+                .data_offset_ = get64(entry),
+            };
+            // reads assume all blocks but the last are full.
+            if (blk_info.data_size_ == 0 || blk_info.data_size_ > max_block_size_
+                || blk_info.data_offset_ + blk_info.data_size_ > frame_end_
+                || block_decompressed_size > max_block_size_
+                || (i + 1 != block_count && block_decompressed_size != max_block_size_))
+            {
+                return false;
+            }
+            blocks.push_back(blk_info);
+            decompressed_size += block_decompressed_size;
+        }
+        if (decompressed_size != get64(header + 24))
+        {
+            return false;
+        }
+        blocks_ = std::move(blocks);
+        decompressed_size_ = decompressed_size;
+        indexed_ = true;
+        return true;
+    }
+
+    void Lz4Reader::scan_blocks(Off offset)
+    {
         uint32_t block_size = 0;
         do
         {
@@ -87,6 +178,7 @@ namespace pstack
             };
             if (blk_info.data_size_ > max_block_size_)
             {
+                blocks_.clear();
                 return;
             }
             if (blk_info.data_size_ > 0)
@@ -105,9 +197,23 @@ namespace pstack
             offset += 4;
         }
 
-        if (offset != upstream_->size())
+        // we only support simple lz4 file with only one lz4 frame, perhaps followed by skippable frames, like an
+        // index we couldn't use.
+        frame_end_ = offset;
+        const Off file_size = upstream_->size();
+        while (file_size - offset >= 2 * sizeof(uint32_t))
         {
-            // we only support simple lz4 file with only one lz4 frame
+            uint32_t skippable[2];
+            upstream_->readObj(offset, skippable, 2);
+            if ((le32toh(skippable[0]) & 0xfffffff0) != (kSkippableMagic & 0xfffffff0))
+            {
+                break;
+            }
+            offset += 2 * sizeof(uint32_t) + le32toh(skippable[1]);
+        }
+        if (offset != file_size)
+        {
+            blocks_.clear();
             return;
         }
 
@@ -120,23 +226,76 @@ namespace pstack
             }
             else
             {
-                if (!read_upstream_up_to(blocks_.back().data_offset_, blocks_.back().data_size_, block_buf_.data()))
+                auto last_block = decompress_block_data(blocks_.size() - 1);
+                if (!last_block)
                 {
+                    blocks_.clear();
                     return;
                 }
-                last_block_decompressed_size = LZ4_decompress_safe_partial(
-                    block_buf_.data(), decompressed_buf_.data(), blocks_.back().data_size_, max_block_size_, max_block_size_);
-                if (last_block_decompressed_size < 0) {
-                    return;
-                }
-                decompressed_buf_.resize(last_block_decompressed_size);
-                decompressed_buf_blk_id_ = blocks_.size() - 1;
+                last_block_decompressed_size = last_block->size();
+                cache_block(blocks_.size() - 1, std::move(last_block));
             }
             decompressed_size_ = (blocks_.size() - 1) * max_block_size_ + last_block_decompressed_size;
         }
     }
 
-    Lz4Reader::~Lz4Reader() {}
+    void Lz4Reader::write_index(std::ostream &os) const
+    {
+        const uint64_t index_size = kIndexHeaderSize + blocks_.size() * kIndexEntrySize + kIndexTrailerSize;
+        if (index_size > std::numeric_limits<uint32_t>::max())
+        {
+            throw Exception() << "too many blocks to index in " << *upstream_;
+        }
+        auto put32 = [&os](uint32_t v) { v = htole32(v); os.write(reinterpret_cast<const char *>(&v), sizeof v); };
+        auto put64 = [&os](uint64_t v) { v = htole64(v); os.write(reinterpret_cast<const char *>(&v), sizeof v); };
+        put32(kSkippableMagic);
+        put32(uint32_t(index_size - 8));
+        put32(kIndexVersion);
+        put32(uint32_t(max_block_size_));
+        put64(blocks_.size());
+        put64(decompressed_size_);
+        for (size_t i = 0; i < blocks_.size(); ++i)
+        {
+            const auto &blk = blocks_[i];
+            const size_t block_decompressed_size = i + 1 == blocks_.size()
+                ? decompressed_size_ - i * max_block_size_
+                : max_block_size_;
+            put64(blk.data_offset_);
+            put32(uint32_t(blk.data_size_) | (blk.uncompressed_ ? 0x80000000U : 0));
+            put32(uint32_t(block_decompressed_size));
+        }
+        put32(uint32_t(index_size));
+        put32(kIndexMagic);
+    }
+
+    void Lz4Reader::appendIndex(Context &context, const std::filesystem::path &path)
+    {
+        Lz4Reader reader(std::make_shared<FileReader>(context, path));
+        if (reader.indexed())
+        {
+            return;
+        }
+        if (reader.blocks_.empty())
+        {
+            throw Exception() << path << " is not an lz4 file with independent blocks in a single frame";
+        }
+        std::ofstream os(path, std::ios::binary | std::ios::app);
+        reader.write_index(os);
+        os.close();
+        if (!os)
+        {
+            throw Exception() << "failed to append index to " << path;
+        }
+    }
+
+    Lz4Reader::~Lz4Reader()
+    {
+        // prefetches refer to us: let them finish.
+        for (auto &[blk_idx, future] : in_flight_)
+        {
+            future.wait();
+        }
+    }
 
     size_t Lz4Reader::read(Off decompressed_offset, size_t req_read_size, char *dst) const
     {
@@ -169,34 +328,130 @@ namespace pstack
 
     Reader::Off Lz4Reader::size() const { return decompressed_size_; }
 
+    size_t Lz4Reader::cached_bytes() const
+    {
+        std::lock_guard<std::mutex> guard(cache_lock_);
+        return cached_bytes_;
+    }
+
     bool Lz4Reader::decompress_block(size_t blk_idx, Off decompressed_offset, size_t req_read_size, char *dst) const {
         auto& blk = blocks_[blk_idx];
         if (blk.uncompressed_)
         {
             return read_upstream_up_to(blk.data_offset_ + decompressed_offset, req_read_size, dst);
         }
+        auto block = get_block(blk_idx);
+        if (!block || block->size() < decompressed_offset + req_read_size) {
+            return false;
+        }
+        std::copy_n(block->data() + decompressed_offset, req_read_size, dst);
+        return true;
+    }
+
+    // reads and decompresses a block, without touching any shared state, so
+    // this can run on worker threads. Returns null on failure.
+    Lz4Reader::DecompressedBlock Lz4Reader::decompress_block_data(size_t blk_idx) const
+    {
+        auto& blk = blocks_[blk_idx];
+        std::vector<char> compressed(blk.data_size_);
+        if (!read_upstream_up_to(blk.data_offset_, blk.data_size_, compressed.data())) {
+            return nullptr;
+        }
+        auto decompressed = std::make_shared<std::vector<char>>(max_block_size_);
+        int decompressed_size = LZ4_decompress_safe_partial(
+            compressed.data(), decompressed->data(), blk.data_size_, max_block_size_, max_block_size_);
+        if (decompressed_size < 0) {
+            return nullptr;
+        }
+        decompressed->resize(decompressed_size);
+        return decompressed;
+    }
 
-        // might hit previusely cached decompressed buffer
-        if (decompressed_buf_blk_id_ != blk_idx)
+    // finds a decompressed block in the cache, waits for it if it's being
+    // prefetched, or decompresses it.
+    Lz4Reader::DecompressedBlock Lz4Reader::get_block(size_t blk_idx) const
+    {
+        std::shared_future<DecompressedBlock> pending;
         {
-            if (!read_upstream_up_to(blk.data_offset_, blk.data_size_, block_buf_.data())) {
-                return false;
+            std::lock_guard<std::mutex> guard(cache_lock_);
+            sequential_run_ = blk_idx == last_blk_idx_ + 1 ? sequential_run_ + 1
+                : blk_idx == last_blk_idx_ ? sequential_run_ : 0;
+            last_blk_idx_ = blk_idx;
+            if (sequential_run_ >= 2)
+            {
+                prefetch_after(blk_idx);
             }
-            decompressed_buf_blk_id_ = std::numeric_limits<decltype(decompressed_buf_blk_id_)>::max();
-            decompressed_buf_.resize(max_block_size_); // should not trigger re-alloc
-            int decompressed_size = LZ4_decompress_safe_partial(
-                block_buf_.data(), decompressed_buf_.data(), blk.data_size_, max_block_size_, max_block_size_);
-            if (decompressed_size < 0) {
-                return false;
+            auto cached = cache_.find(blk_idx);
+            if (cached != cache_.end())
+            {
+                lru_.splice(lru_.begin(), lru_, cached->second.lru_pos_);
+                return cached->second.data_;
+            }
+            auto in_flight = in_flight_.find(blk_idx);
+            if (in_flight != in_flight_.end())
+            {
+                pending = in_flight->second;
             }
-            decompressed_buf_.resize(decompressed_size);
-            decompressed_buf_blk_id_ = blk_idx;
         }
-        if (decompressed_buf_.size() < decompressed_offset + req_read_size) {
-            return false;
+        DecompressedBlock block = pending.valid() ? pending.get() : decompress_block_data(blk_idx);
+        if (block)
+        {
+            std::lock_guard<std::mutex> guard(cache_lock_);
+            in_flight_.erase(blk_idx);
+            cache_block(blk_idx, block);
+        }
+        return block;
+    }
+
+    // adds a block to the cache, evicting the least recently used blocks
+    // beyond our budget. We always keep the block just added.
+    void Lz4Reader::cache_block(size_t blk_idx, DecompressedBlock block) const
+    {
+        if (cache_.count(blk_idx) != 0)
+        {
+            return;
+        }
+        cached_bytes_ += block->size();
+        lru_.push_front(blk_idx);
+        cache_.emplace(blk_idx, CachedBlock{ std::move(block), lru_.begin() });
+        while (cached_bytes_ > cache_budget_ && lru_.size() > 1)
+        {
+            auto evicted = cache_.find(lru_.back());
+            cached_bytes_ -= evicted->second.data_->size();
+            cache_.erase(evicted);
+            lru_.pop_back();
+        }
+    }
+
+    // the reader is moving through blocks in sequence: start decompressing
+    // the next few on worker threads. Called with cache_lock_ held.
+    void Lz4Reader::prefetch_after(size_t blk_idx) const
+    {
+        // move finished prefetches into the cache.
+        for (auto it = in_flight_.begin(); it != in_flight_.end();)
+        {
+            if (it->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            {
+                ++it;
+                continue;
+            }
+            if (auto block = it->second.get())
+            {
+                cache_block(it->first, std::move(block));
+            }
+            it = in_flight_.erase(it);
+        }
+        // don't prefetch more than the cache could hold.
+        const size_t limit = std::min(prefetch_blocks_, cache_budget_ / max_block_size_);
+        for (size_t next = blk_idx + 1; next <= blk_idx + limit && next < blocks_.size(); ++next)
+        {
+            if (blocks_[next].uncompressed_ || cache_.count(next) != 0 || in_flight_.count(next) != 0)
+            {
+                continue;
+            }
+            in_flight_.emplace(next, std::async(std::launch::async,
+                  [this, next] { return decompress_block_data(next); }).share());
         }
-        std::copy_n(decompressed_buf_.data() + decompressed_offset, req_read_size, dst);
-        return true;
     }
 
     bool Lz4Reader::read_upstream_up_to(Off offset, size_t req_size, char *dst) const
@@ -8,12 +8,17 @@
 #include <iostream>
 #include <limits>
 #include <set>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <exception>
 #include <ucontext.h>
 #include <sys/wait.h>
 #include <csignal>
 #include <sys/signal.h>
 
 #include "libpstack/arch.h"
+#include "libpstack/concurrency.h"
 #include "libpstack/dwarf.h"
 #include "libpstack/proc.h"
 #include "libpstack/stringify.h"
@@ -28,6 +33,7 @@
 #define SP(regs) (regs.user.esp)
 #define IP(regs) (regs.user.eip)
 #elif defined(__aarch64__)
+#define SP(regs) (regs.user.sp)
 #define IP(regs) (regs.user.pc)
 #endif
 namespace pstack {;
@@ -192,11 +198,17 @@ Process::load()
         // We were unable to read the link map.
         // The primary cause is that the core file is truncated.
         // Go do the Hail Mary version.
-        if (loadSharedObjectsFromFileNote())
+        if (loadSharedObjectsFromFileNote()) {
+            if (context.options.prefetch)
+                prefetchObjects();
             return;
+        }
         throw;
     }
 
+    if (context.options.prefetch)
+        prefetchObjects();
+
     if (!context.options.nothreaddb) {
         auto *tdb = loadThreadDb();
         if (tdb) {
@@ -211,6 +223,52 @@ Process::load()
 
 }
 
+/*
+ * Open all the mapped objects, and do the work we'd otherwise do the first
+ * time an unwind lands in each one - parsing section headers and build IDs,
+ * and indexing the call frame information - spread across a pool of threads.
+ */
+void
+Process::prefetchObjects()
+{
+    size_t jobs = context.options.jobs > 1
+        ? size_t(context.options.jobs)
+        : std::max(std::thread::hardware_concurrency(), 1U);
+
+    // Each mapping is opened by one thread, so the lazy initialization in
+    // MappedObject::object is safe here.
+    std::vector<MappedObject *> mapped;
+    for (auto &[addr, obj] : objects)
+        mapped.push_back(&obj);
+    std::vector<Elf::Object::sptr> images(mapped.size());
+    forEachConcurrently(mapped.size(), jobs, [&](size_t i) {
+        try {
+            images[i] = mapped[i]->object(context);
+        }
+        catch (const std::exception &ex) {
+            if (context.verbose)
+                *context.debug << "prefetch of " << mapped[i]->name() << " failed: " << ex.what() << "\n";
+        }
+    });
+
+    // Several mappings can share an image: index each only once.
+    std::sort(images.begin(), images.end());
+    images.erase(std::unique(images.begin(), images.end()), images.end());
+    std::erase(images, nullptr);
+    forEachConcurrently(images.size(), jobs, [&](size_t i) {
+        try {
+            auto &image = images[i];
+            image->getBuildID();
+            image->getSection(".eh_frame_hdr", SHT_PROGBITS);
+            context.findDwarf(image)->getCFI();
+        }
+        catch (const std::exception &ex) {
+            if (context.verbose)
+                *context.debug << "prefetch of " << *images[i]->io << " failed: " << ex.what() << "\n";
+        }
+    });
+}
+
 Dwarf::Info::sptr
 Process::getDwarf(Elf::Object::sptr elf) const
 {
@@ -463,6 +521,21 @@ Dwarf::DIE removeCV(Dwarf::DIE type) {
     return type;
 }
 
+// A type that's only declared here has no size: find its definition by name,
+// if the object has one. Without a name index, that would mean decoding every
+// unit in the object, which isn't worth it to print an argument.
+Dwarf::DIE completeType(Dwarf::DIE type) {
+    if (!type || !type.attribute(Dwarf::DW_AT_declaration).valid())
+        return type;
+    auto dwarf = type.getUnit()->dwarf;
+    if (!dwarf->hasNameIndex())
+        return type;
+    for (auto &definition : dwarf->findDefinitions(type.qualifiedName()))
+        if (definition.tag() == type.tag())
+            return definition;
+    return type;
+}
+
 struct ArgPrint {
     Process &p;
     const StackFrame &frame;
@@ -482,7 +555,7 @@ struct RemoteValue {
     RemoteValue(const Process &p_, Elf::Addr addr_, bool isValue, DIE type_)
         : p(p_)
         , addr(addr_)
-        , type(removeCV( std::move(type_)) ) {
+        , type(completeType(removeCV( std::move(type_))) ) {
       if (isValue) {
          buf.resize(sizeof addr_);
          memcpy(&buf[0], &addr_, sizeof addr_);
@@ -809,6 +882,12 @@ Process::addElfObject(std::string_view name, const Elf::Object::sptr &obj, Elf::
     }
 
     objects.emplace(std::make_pair(load, MappedObject{ name, bid, obj }));
+    {
+        // Any symbol we've resolved (or failed to) may now be found elsewhere.
+        std::lock_guard<std::mutex> guard(resolvedSymbolsLock);
+        for (auto &memo : resolvedSymbols)
+            memo.clear();
+    }
     if (context.verbose >= 2) {
         IOFlagSave _(*context.debug);
         *context.debug << "object " << name;
@@ -828,9 +907,25 @@ Process::loadSharedObjects(Elf::Addr rdebugAddr)
     io->readObj(rdebugAddr, &rDebug);
 
     /* Iterate over the r_debug structure's entries, loading libraries */
-    struct link_map map;
-    for (auto mapAddr = Elf::Addr(rDebug.r_map); mapAddr != 0; mapAddr = Elf::Addr(map.l_next)) {
-        io->readObj(mapAddr, &map);
+    std::vector<std::pair<Elf::Addr, struct link_map>> maps;
+    struct link_map lm;
+    for (auto mapAddr = Elf::Addr(rDebug.r_map); mapAddr != 0; mapAddr = Elf::Addr(lm.l_next)) {
+        io->readObj(mapAddr, &lm);
+        maps.emplace_back(mapAddr, lm);
+    }
+
+    // Fetch the names of all the objects in one batch. Most paths fit in the
+    // buffer we give them - we read any that don't individually below.
+    static constexpr size_t NAMELEN = 256;
+    std::vector<char> names(maps.size() * NAMELEN);
+    std::vector<Reader::Segment> nameSegments;
+    for (size_t i = 0; i < maps.size(); ++i)
+        nameSegments.push_back({ Elf::Off(maps[i].second.l_name), maps[i].second.l_name == 0 ? 0 : NAMELEN,
+              names.data() + i * NAMELEN, 0 });
+    io->readv(nameSegments);
+
+    for (size_t i = 0; i < maps.size(); ++i) {
+        auto &[mapAddr, map] = maps[i];
 
         // If we see the executable, just add it in and avoid going through the path
         // replacement work
@@ -856,7 +951,11 @@ Process::loadSharedObjects(Elf::Addr rdebugAddr)
         if (map.l_name == 0)
             continue;
 
-        std::string path = io->readString(Elf::Off(map.l_name));
+        const auto &seg = nameSegments[i];
+        auto len = strnlen(seg.ptr, seg.rc);
+        std::string path = len < seg.rc
+            ? std::string(seg.ptr, len)
+            : io->readString(Elf::Off(map.l_name));
         if (path == "")
             continue;
         try {
@@ -927,7 +1026,11 @@ Process::findSegment(Elf::Addr addr)
     auto it = objects.lower_bound(addr);
     if (it != objects.begin()) {
        --it;
-       auto obj = it->second.object(context);
+       Elf::Object::sptr obj;
+       {
+           std::lock_guard guard(objectLock);
+           obj = it->second.object(context);
+       }
        if (obj && it->first + obj->endVA() >= addr) {
            auto segment = obj->getSegmentForAddress(addr - it->first);
            if (segment)
@@ -941,22 +1044,57 @@ std::tuple<Elf::Object::sptr, Elf::Addr, Elf::Sym>
 Process::resolveSymbolDetail(const char *name, bool includeDebug,
         std::function<bool(std::string_view)> match)
 {
-    for (auto &loaded : objects) {
-        if (!match(loaded.second.name()))
+    auto &memo = resolvedSymbols[includeDebug ? 1 : 0];
+    auto start = objects.begin();
+    {
+        std::lock_guard<std::mutex> guard(resolvedSymbolsLock);
+        auto cached = memo.find(std::string_view(name));
+        if (cached != memo.end()) {
+            if (!cached->second)
+                throw (Exception() << "symbol " << name << " not found");
+            auto loaded = objects.find(std::get<1>(*cached->second));
+            if (match(loaded->second.name()))
+                return *cached->second;
+            // No object before this one defines the symbol: carry on after it.
+            start = std::next(loaded);
+        }
+    }
+
+    // We can only remember the result if we looked at every object up to it.
+    bool exhaustive = start == objects.begin();
+    const std::string_view sname(name);
+    const uint32_t hash = Elf::gnuHash(sname);
+    std::optional<ResolvedSymbol> result;
+    for (auto loaded = start; loaded != objects.end(); ++loaded) {
+        if (!match(loaded->second.name())) {
+           exhaustive = false;
            continue;
-        auto obj = loaded.second.object(context);
+        }
+        auto obj = loaded->second.object(context);
         if (!obj)
             continue;
-        auto [sym,idx] = obj->findDynamicSymbol(name);
-        if (sym.st_shndx != SHN_UNDEF)
-           return std::make_tuple(obj, loaded.first, sym);
+        if (obj->mayHaveDynamicSymbol(hash)) {
+           auto [sym,idx] = obj->findDynamicSymbol(sname);
+           if (sym.st_shndx != SHN_UNDEF) {
+              result = std::make_tuple(obj, loaded->first, sym);
+              break;
+           }
+        }
         if (includeDebug) {
-           auto [sym, idx] = loaded.second.object(context)->findDebugSymbol(name);
-           if (sym.st_shndx != SHN_UNDEF)
-              return std::make_tuple(obj, loaded.first, sym);
+           auto [sym, idx] = obj->findDebugSymbol(sname);
+           if (sym.st_shndx != SHN_UNDEF) {
+              result = std::make_tuple(obj, loaded->first, sym);
+              break;
+           }
         }
     }
-    throw (Exception() << "symbol " << name << " not found");
+    if (exhaustive) {
+        std::lock_guard<std::mutex> guard(resolvedSymbolsLock);
+        memo.emplace(std::string(sname), result);
+    }
+    if (!result)
+        throw (Exception() << "symbol " << name << " not found");
+    return *result;
 }
 
 Elf::Addr
@@ -1165,8 +1303,11 @@ Lwp::unwind(Process &p, const CoreRegisters &regs)
                     // null base pointer means we're done.
                     break;
                 }
-                auto newIp = p.io->readObj<Elf::Addr> (oldBp + ELF_BYTES);
-                auto newBp = p.io->readObj<Elf::Addr>(oldBp);
+                // The saved base pointer and return address are adjacent.
+                Elf::Addr frame[2];
+                p.io->readObj(oldBp, frame, 2);
+                auto newBp = frame[0];
+                auto newIp = frame[1];
                 auto [ _1, _2, segment ] = p.findSegment(newIp);
 
                 // If the value we got for the instruction pointer is in an
@@ -1226,30 +1367,84 @@ Process::getTaskName([[maybe_unused]] lwpid_t lwp) const {
 
 Stacks
 Process::getStacks() {
-    Stacks stacks;
+    if (context.options.snapshotStack != 0)
+        return getStacksFromSnapshot();
+
+    std::map<lwpid_t, CoreRegisters> regs;
     StopProcess processSuspender(this);
 
     /*
      * Find LWPs, the kernel scheduled entities.
      */
-    listLWPs([this, &stacks ](lwpid_t lwpid) {
-          Lwp lwp;
-          lwp.id = lwpid;
+    listLWPs([this, &regs ](lwpid_t lwpid) {
           try {
-             lwp.unwind(*this, getCoreRegs(lwpid));
-             lwp.name = getTaskName(lwpid);
-             stacks.emplace(std::make_pair(lwpid, std::move(lwp)));
+             regs[lwpid] = getCoreRegs(lwpid);
           }
           catch (const Exception &ex) {
             *context.debug << "failed to unwind stack for  " << lwpid << ": " << ex.what() << "\n";
           }
        });
 
-    /*
-     * Use the thread db to find at least the thread ids for each lwp. We
-     * assume that we are in the modern linux 1:1 threading world, and punt on
-     * anything more sophisticated here.
-     */
+    Stacks stacks = unwindStacks(regs);
+    addThreadInfo(stacks);
+    return stacks;
+}
+
+/*
+ * Unwind the stack for each LWP from its registers. With more than one job,
+ * worker threads take LWPs from a shared index until they are all done.
+ * Results are collected per LWP, and names and errors are reported
+ * afterwards, so the output does not depend on which thread did the work.
+ * Registers must be fetched beforehand: ptrace requests have to come from the
+ * thread that attached to the process.
+ */
+Stacks
+Process::unwindStacks(const std::map<lwpid_t, CoreRegisters> &regs) {
+    std::vector<std::pair<lwpid_t, const CoreRegisters *>> work;
+    for (auto &[lwpid, lwpRegs] : regs)
+        work.emplace_back(lwpid, &lwpRegs);
+
+    std::vector<Lwp> lwps(work.size());
+    std::vector<std::exception_ptr> failures(work.size());
+    size_t jobs = std::max(context.options.jobs, 1);
+#ifdef __aarch64__
+    // Lwp::unwind looks up the signal trampoline in the VDSO: make sure its
+    // symbol tables are loaded before we have threads doing that concurrently.
+    if (jobs > 1 && vdsoImage)
+        vdsoImage->findDynamicSymbol("__kernel_rt_sigreturn");
+#endif
+    forEachConcurrently(work.size(), jobs, [&](size_t i) {
+        lwps[i].id = work[i].first;
+        try {
+            lwps[i].unwind(*this, *work[i].second);
+        }
+        catch (...) {
+            failures[i] = std::current_exception();
+        }
+    });
+
+    Stacks stacks;
+    for (size_t i = 0; i < work.size(); ++i) {
+        try {
+            if (failures[i])
+                std::rethrow_exception(failures[i]);
+            lwps[i].name = getTaskName(lwps[i].id);
+            stacks.emplace(std::make_pair(lwps[i].id, std::move(lwps[i])));
+        }
+        catch (const Exception &ex) {
+            *context.debug << "failed to unwind stack for  " << work[i].first << ": " << ex.what() << "\n";
+        }
+    }
+    return stacks;
+}
+
+/*
+ * Use the thread db to find at least the thread ids for each lwp. We
+ * assume that we are in the modern linux 1:1 threading world, and punt on
+ * anything more sophisticated here.
+ */
+void
+Process::addThreadInfo(Stacks &stacks) {
     if (agent) {
        listThreads([this, &stacks] ( const td_thrhandle_t *thr) {
           td_thrinfo_t info;
@@ -1263,9 +1458,108 @@ Process::getStacks() {
           }
        });
     }
+}
+
+/*
+ * Like getStacks, but only keep the process stopped long enough to grab the
+ * registers and the top of the stack for each LWP. We resume the process,
+ * then unwind from the snapshot. Memory outside the captured stacks is read
+ * from the (now running) process, so may be inconsistent with the snapshot -
+ * this is usually fine for text and long-lived data structures.
+ */
+Stacks
+Process::getStacksFromSnapshot() {
+    // If a previous call left a snapshot in place, start afresh from the
+    // underlying memory.
+    if (auto previous = std::dynamic_pointer_cast<SnapshotReader>(io))
+        io = previous->upstream();
+
+    std::map<lwpid_t, CoreRegisters> regs;
+    auto snapshot = std::make_shared<SnapshotReader>(io);
+    {
+        StopProcess processSuspender(this);
+        listLWPs([this, &regs ](lwpid_t lwpid) {
+              try {
+                 regs[lwpid] = getCoreRegs(lwpid);
+              }
+              catch (const Exception &ex) {
+                *context.debug << "failed to get registers for " << lwpid << ": " << ex.what() << "\n";
+              }
+           });
+
+        // Include the x86_64 ABI's 128-byte red zone below the stack pointer.
+        static constexpr Elf::Addr REDZONE = 128;
+        std::vector<std::pair<Reader::Off, size_t>> stacks;
+        for (auto &[lwpid, lwpRegs] : regs) {
+            Elf::Addr sp = SP(lwpRegs);
+            sp = sp > REDZONE ? sp - REDZONE : 0;
+            stacks.emplace_back(sp, context.options.snapshotStack + REDZONE);
+        }
+        snapshot->capture(stacks);
+    }
+    io = snapshot;
+
+    Stacks stacks = unwindStacks(regs);
+    addThreadInfo(stacks);
     return stacks;
 }
 
+void
+SnapshotReader::capture(const std::vector<std::pair<Off, size_t>> &toCapture)
+{
+    std::vector<std::vector<char>> buffers;
+    std::vector<Segment> segments;
+    buffers.reserve(toCapture.size());
+    for (auto [off, len] : toCapture) {
+        buffers.emplace_back(len);
+        segments.push_back({ off, len, buffers.back().data(), 0 });
+    }
+    upstream_->readv(segments);
+    for (size_t i = 0; i < segments.size(); ++i) {
+        if (segments[i].rc == 0)
+            continue;
+        buffers[i].resize(segments[i].rc);
+        ranges.emplace(segments[i].off, std::move(buffers[i]));
+    }
+}
+
+size_t
+SnapshotReader::read(Off off, size_t count, char *ptr) const
+{
+    Off start = off;
+    while (count != 0) {
+        auto next = ranges.upper_bound(off);
+        if (next != ranges.begin()) {
+            const auto &[base, data] = *std::prev(next);
+            if (off < base + data.size()) {
+                size_t chunk = std::min(count, size_t(base + data.size() - off));
+                memcpy(ptr, data.data() + (off - base), chunk);
+                off += chunk;
+                ptr += chunk;
+                count -= chunk;
+                continue;
+            }
+        }
+        // Not captured: go upstream, as far as the next captured range.
+        size_t chunk = next == ranges.end() ? count : std::min(count, size_t(next->first - off));
+        size_t rc;
+        try {
+            rc = upstream_->read(off, chunk, ptr);
+        }
+        catch (const Exception &) {
+            if (off == start)
+                throw;
+            break;
+        }
+        off += rc;
+        ptr += rc;
+        count -= rc;
+        if (rc != chunk)
+            break;
+    }
+    return off - start;
+}
+
 CoreRegisters
 Process::getCoreRegs(lwpid_t lwp) {
    CoreRegisters coreRegs;
@@ -5,6 +5,9 @@
 #define WITH_PYTHON
 #include "libpstack/python.h"
 #endif
+#if defined(WITH_LZ4)
+#include "libpstack/lz4reader.h"
+#endif
 
 #include <sys/types.h>
 #include <sys/signal.h>
@@ -386,6 +389,52 @@ emain(int argc, char **argv, Context &context)
     .add("no-local-files", Flags::LONGONLY,
           "don't assume local files match the process's view, and don't open them",
           Flags::setf( context.options.noLocalFiles ) )
+    .add("snapshot", Flags::LONGONLY, "bytes",
+          "copy the registers and up to <bytes> of stack for each thread, then resume the "
+          "process before unwinding, minimizing the time it is stopped",
+          Flags::set(context.options.snapshotStack))
+    .add("jobs", Flags::LONGONLY, "threads",
+          "unwind the stacks of the target's threads using up to <threads> "
+          "threads of our own",
+          Flags::set(context.options.jobs))
+    .add("prefetch", Flags::LONGONLY,
+          "open and index all the target's shared objects concurrently before "
+          "unwinding, using the number of threads given by --jobs, or one per CPU",
+          Flags::setf(context.options.prefetch))
+    .add("index-cache", Flags::LONGONLY, "directory",
+          "save indexes of DWARF compilation units by address in <directory>, "
+          "and reuse them in later invocations",
+          [&](const char *arg) { context.options.indexCache = arg; })
+    .add("lazy-decompress", Flags::LONGONLY, "megabytes",
+          "decompress compressed ELF sections larger than <megabytes> on demand, "
+          "rather than all at once",
+          [&](const char *arg) { context.options.lazyDecompressSize = size_t(std::stoul(arg)) * 1024 * 1024; })
+#if defined(WITH_LZ4)
+    .add("lz4-cache", Flags::LONGONLY, "megabytes",
+          "keep up to <megabytes> of decompressed blocks when reading lz4-compressed cores",
+          [&](const char *arg) { context.options.lz4CacheSize = size_t(std::stoul(arg)) * 1024 * 1024; })
+    .add("lz4-index", Flags::LONGONLY, "lz4 file",
+          "append a block index to an lz4-compressed core file, so it can be "
+          "opened without scanning all its blocks, and exit",
+          [&](const char *arg) {
+             Lz4Reader::appendIndex(context, arg);
+             exitCode = 0; })
+#endif
+    .add("live-memory", Flags::LONGONLY, "method",
+          "how to read the memory of live processes: \"proc\" for /proc/<pid>/mem, "
+          "\"vm\" for process_vm_readv, or \"auto\" (the default) to use "
+          "process_vm_readv where it works",
+          [&](const char *arg) {
+             std::string_view method = arg;
+             if (method == "proc")
+                context.options.liveMemory = LiveMemory::PROCFS;
+             else if (method == "vm")
+                context.options.liveMemory = LiveMemory::VMREADV;
+             else if (method == "auto")
+                context.options.liveMemory = LiveMemory::AUTO;
+             else
+                throw (Exception() << "unknown live memory method " << method);
+          })
 
     .parse(argc, argv);
 
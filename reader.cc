@@ -1,12 +1,15 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <cassert>
 #include <cstdint>
 #include "libpstack/reader.h"
 #include <cstring>
+#include <algorithm>
 #include <utility>
+#include <unordered_set>
 #if defined(WITH_LZ4)
 #include "libpstack/lz4reader.h"
 #endif
@@ -83,6 +86,14 @@ AbstractMemReader::describe(std::ostream &os) const
     os << descr;
 }
 
+std::span<const char>
+AbstractMemReader::span(Off off, size_t count) const
+{
+    if (off >= Off(size()))
+        return {};
+    return { ptroff(data(), off), std::min(count, size_t(size()) - size_t(off)) };
+}
+
 string
 AbstractMemReader::readString(Off offset) const {
    return string(ptroff(data(), offset));
@@ -105,6 +116,55 @@ Reader::readString(Off offset) const
     return res;
 }
 
+void
+Reader::readv(std::span<Segment> segments) const
+{
+    for (auto &seg : segments) {
+        try {
+            seg.rc = read(seg.off, seg.count, seg.ptr);
+        }
+        catch (const Exception &) {
+            seg.rc = 0;
+        }
+    }
+}
+
+std::optional<std::string_view>
+Reader::stringView(Off offset) const
+{
+    Off sz = size();
+    if (offset >= sz)
+        return std::nullopt;
+    auto mem = span(offset, sz - offset);
+    if (mem.empty())
+        return std::nullopt;
+    auto end = static_cast<const char *>(memchr(mem.data(), 0, mem.size()));
+    if (end == nullptr)
+        return std::nullopt;
+    return std::string_view(mem.data(), end - mem.data());
+}
+
+bool
+Reader::stringEquals(Off offset, std::string_view name) const
+{
+    if (auto direct = stringView(offset); direct)
+        return *direct == name;
+    // Compare a chunk at a time, including the terminating NUL.
+    char buf[64];
+    for (size_t pos = 0; pos <= name.size(); ) {
+        size_t want = std::min(sizeof buf, name.size() + 1 - pos);
+        if (read(offset + pos, want, buf) != want)
+            return false;
+        size_t fromName = std::min(want, name.size() - pos);
+        if (memcmp(buf, name.data() + pos, fromName) != 0)
+            return false;
+        if (fromName != want && buf[fromName] != '\0')
+            return false;
+        pos += want;
+    }
+    return true;
+}
+
 Reader::csptr
 Reader::view(const std::string &name, Off offset, Off size) const {
    return std::make_shared<OffsetReader>(name, shared_from_this(), offset, size);
@@ -124,74 +184,158 @@ FileReader::read(Off off, size_t count, char *ptr) const
 }
 
 void
-CacheReader::Page::load(const Reader &r, Off offset_)
+FileReader::readv(std::span<Segment> segments) const
 {
-    assert(offset_ % data.size() == 0);
-    len = r.read(offset_, data.size(), data.data());
-    offset = offset_;
+    // Runs of segments that are adjacent in the file are read with a single
+    // preadv. Others still need a system call each.
+    std::vector<iovec> iov;
+    for (size_t start = 0; start != segments.size(); ) {
+        size_t end = start + 1;
+        Off next = segments[start].off + segments[start].count;
+        while (end != segments.size() && end - start < IOV_MAX && segments[end].off == next) {
+            next += segments[end].count;
+            ++end;
+        }
+        iov.clear();
+        for (size_t i = start; i != end; ++i)
+            iov.push_back({ segments[i].ptr, segments[i].count });
+        auto rc = preadv(file, iov.data(), int(iov.size()), segments[start].off);
+        if (rc == -1) {
+            // Some of the run may still be readable: try its segments individually.
+            Reader::readv(segments.subspan(start, end - start));
+        } else {
+            for (size_t i = start; i != end; ++i) {
+                segments[i].rc = std::min(size_t(rc), segments[i].count);
+                rc -= segments[i].rc;
+            }
+        }
+        start = end;
+    }
 }
 
-CacheReader::CacheReader(Reader::csptr upstream_)
+const CacheReader::Config CacheReader::defaultConfig { 256, 16 * 256, 256 };
+const CacheReader::Config CacheReader::liveMemoryConfig { 4096, 1024 * 1024, 16 * 1024 };
+const CacheReader::Config CacheReader::fileConfig { 4096, 4 * 1024 * 1024, 256 * 1024 };
+
+CacheReader::CacheReader(Reader::csptr upstream_, const Config &config)
     : upstream(std::move(upstream_))
+    , pageSize(std::max(config.pageSize, size_t(1)))
+    , maxPages(std::max(config.maxBytes / pageSize, size_t(1)))
+    , maxReadaheadPages(std::clamp(config.maxReadahead / pageSize, size_t(1), maxPages))
 {
 }
 
 void
 CacheReader::flush() {
+    std::lock_guard guard(cacheLock);
     pages.clear();
+    pageIndex.clear();
+    stringCache.clear();
+    nextSequential = std::numeric_limits<Off>::max();
+    readahead = 1;
 }
 
+// Find a page to hold the content at "pageoff", recycling the least recently
+// used page if the cache is full. The page is indexed, and at the front of
+// the LRU list, but its content is not loaded.
 CacheReader::Page &
+CacheReader::allocPage(Off pageoff) const
+{
+    if (pages.size() >= maxPages) {
+        auto victim = std::prev(pages.end());
+        pageIndex.erase(victim->offset);
+        pages.splice(pages.begin(), pages, victim);
+    } else {
+        pages.push_front(Page{ 0, 0, std::unique_ptr<char[]>(new char[pageSize]) });
+    }
+    Page &page = pages.front();
+    page.offset = pageoff;
+    page.len = 0;
+    pageIndex[pageoff] = pages.begin();
+    return page;
+}
+
+const CacheReader::Page &
 CacheReader::getPage(Off pageoff) const
 {
-    bool first = true;
-    for (auto i = pages.begin(); i != pages.end(); ++i) {
-        if ((*i)->offset == pageoff) {
-            // move page to front.
-            if (!first) {
-                auto page = std::exchange(*i, nullptr);
-                pages.erase(i);
-                pages.push_front(std::move(page));
-            }
-            return **pages.begin();
+    auto found = pageIndex.find(pageoff);
+    if (found != pageIndex.end()) {
+        pages.splice(pages.begin(), pages, found->second);
+        return *found->second;
+    }
+
+    readahead = pageoff == nextSequential ? std::min(readahead * 2, maxReadaheadPages) : 1;
+
+    size_t rc = 0;
+    if (readahead > 1) {
+        readaheadBuf.resize(readahead * pageSize);
+        try {
+            rc = upstream->read(pageoff, readaheadBuf.size(), readaheadBuf.data());
+        }
+        catch (const Exception &) {
+            // Some of the range may be unreadable - retry for just this page.
+            readahead = 1;
         }
-        first = false;
     }
 
-    std::unique_ptr<Page> p;
-    if (pages.size() == MAXPAGES) {
-        // steal the oldest page.
-        p = std::exchange( pages.back(), nullptr );
-        pages.pop_back();
-    } else {
-        p = std::make_unique<Page>();
+    if (readahead == 1) {
+        Page &page = allocPage(pageoff);
+        try {
+            page.len = upstream->read(pageoff, pageSize, page.data.get());
+        }
+        catch (const Exception &) {
+            // don't leave an empty page in the cache for a failed read.
+            pageIndex.erase(pageoff);
+            pages.pop_front();
+            throw;
+        }
+        nextSequential = pageoff + pageSize;
+        return page;
     }
-    p->load(*upstream, pageoff);
-    pages.push_front(std::move(p));
-    return **pages.begin();
+
+    // Split the data we read into pages. Insert them in reverse order, so the
+    // page we were asked for ends up most recently used.
+    size_t loaded = std::max((rc + pageSize - 1) / pageSize, size_t(1));
+    for (size_t i = loaded; i-- != 0; ) {
+        Off off = pageoff + i * pageSize;
+        if (i != 0 && pageIndex.find(off) != pageIndex.end())
+            continue;
+        Page &page = allocPage(off);
+        page.len = std::min(pageSize, rc - std::min(rc, i * pageSize));
+        memcpy(page.data.get(), readaheadBuf.data() + i * pageSize, page.len);
+    }
+    nextSequential = pageoff + loaded * pageSize;
+    return pages.front();
 }
 
 size_t
 CacheReader::read(Off off, size_t count, char *ptr) const
 {
-    if (count >= PAGESIZE)
+    if (count >= pageSize)
         return upstream->read(off, count, ptr);
+    std::lock_guard guard(cacheLock);
+    return readCached(off, count, ptr);
+}
+
+size_t
+CacheReader::readCached(Off off, size_t count, char *ptr) const
+{
     Off startoff = off;
     for (;;) {
         if (count == 0)
             break;
-        size_t offsetOfDataInPage = off % PAGESIZE;
+        size_t offsetOfDataInPage = off % pageSize;
         Off offsetOfPageInFile = off - offsetOfDataInPage;
         try {
-           Page &page = getPage(offsetOfPageInFile);
+           const Page &page = getPage(offsetOfPageInFile);
            if (offsetOfDataInPage >= page.len)
               break;
            size_t chunk = std::min(page.len - offsetOfDataInPage, count);
-           memcpy(ptr, page.data.data() + offsetOfDataInPage, chunk);
+           memcpy(ptr, page.data.get() + offsetOfDataInPage, chunk);
            off += chunk;
            count -= chunk;
            ptr += chunk;
-           if (page.len != PAGESIZE)
+           if (page.len != pageSize)
                break;
         }
         catch (const Exception &e) {
@@ -201,13 +345,154 @@ CacheReader::read(Off off, size_t count, char *ptr) const
     return off - startoff;
 }
 
+void
+CacheReader::readv(std::span<Segment> segments) const
+{
+    // Find the pages we need that are not yet cached, and fetch them from
+    // upstream in a single batch, along with any reads large enough to
+    // bypass the cache. Limit the batch to the size of the cache, so pages
+    // we're loading don't evict each other.
+    std::vector<Segment> fetches;
+    std::vector<Page *> fetchPages;
+    std::unordered_set<Off> queued;
+    std::vector<size_t> large;
+    std::lock_guard guard(cacheLock);
+    for (size_t i = 0; i < segments.size(); ++i) {
+        auto &seg = segments[i];
+        if (seg.count >= pageSize) {
+            large.push_back(i);
+            continue;
+        }
+        Off first = seg.off - seg.off % pageSize;
+        for (Off pageoff = first; pageoff < seg.off + seg.count; pageoff += pageSize) {
+            if (fetchPages.size() == maxPages)
+                break;
+            if (pageIndex.find(pageoff) != pageIndex.end() || !queued.insert(pageoff).second)
+                continue;
+            Page &page = allocPage(pageoff);
+            fetches.push_back({ pageoff, pageSize, page.data.get(), 0 });
+            fetchPages.push_back(&page);
+        }
+    }
+    for (auto i : large)
+        fetches.push_back(segments[i]);
+
+    upstream->readv(fetches);
+
+    // A page we failed to read in full may be a transient failure - don't
+    // cache it. readCached below will retry it on its own.
+    for (size_t i = 0; i < fetchPages.size(); ++i) {
+        if (fetches[i].rc == pageSize) {
+            fetchPages[i]->len = pageSize;
+        } else {
+            auto it = pageIndex.find(fetchPages[i]->offset);
+            pages.erase(it->second);
+            pageIndex.erase(it);
+        }
+    }
+    for (size_t i = 0; i < large.size(); ++i)
+        segments[large[i]].rc = fetches[fetchPages.size() + i].rc;
+
+    // Everything else is now satisfied from the cache.
+    for (auto &seg : segments)
+        if (seg.count < pageSize)
+            seg.rc = readCached(seg.off, seg.count, seg.ptr);
+}
+
 string
 CacheReader::readString(Off off) const
 {
-    auto [it, neu] = stringCache.insert(std::make_pair(off, std::string{}));
-    if (neu)
-        it->second = Reader::readString(off);
-    return it->second;
+    {
+        std::lock_guard guard(cacheLock);
+        auto it = stringCache.find(off);
+        if (it != stringCache.end())
+            return it->second;
+    }
+    // Reader::readString calls back into read, so don't hold the lock here.
+    auto str = Reader::readString(off);
+    std::lock_guard guard(cacheLock);
+    return stringCache.emplace(off, std::move(str)).first->second;
+}
+
+ChunkedReader::ChunkedReader(size_t chunkSize_, size_t cacheBytes)
+    : chunkSize(chunkSize_)
+    , maxChunks(std::max(cacheBytes / chunkSize_, size_t(2)))
+{
+}
+
+void
+ChunkedReader::addChunk(Off offset, std::vector<char> &&data) const
+{
+    auto existing = chunkIndex.find(offset);
+    if (existing != chunkIndex.end()) {
+        chunks.splice(chunks.begin(), chunks, existing->second);
+        return;
+    }
+    chunks.push_front(Chunk{ offset, std::move(data) });
+    chunkIndex[offset] = chunks.begin();
+    while (chunks.size() > maxChunks) {
+        chunkIndex.erase(chunks.back().offset);
+        chunks.pop_back();
+    }
+}
+
+const ChunkedReader::Chunk &
+ChunkedReader::getChunk(Off offset) const
+{
+    Off chunkOffset = chunkStart(offset);
+    auto cached = chunkIndex.find(chunkOffset);
+    if (cached == chunkIndex.end()) {
+        decodeChunk(chunkOffset);
+        cached = chunkIndex.find(chunkOffset);
+        if (cached == chunkIndex.end())
+            throw (Exception() << "failed to decode offset " << offset << " of " << *this);
+    }
+    chunks.splice(chunks.begin(), chunks, cached->second);
+    return *cached->second;
+}
+
+size_t
+ChunkedReader::read(Off offset, size_t count, char *ptr) const
+{
+    std::lock_guard guard(lock);
+    size_t startCount = count;
+    Off end = size();
+    while (count != 0 && offset < end) {
+        const Chunk &chunk = getChunk(offset);
+        size_t chunkOff = offset - chunk.offset;
+        if (chunkOff >= chunk.data.size())
+            break;
+        auto amount = std::min(chunk.data.size() - chunkOff, count);
+        memcpy(ptr, chunk.data.data() + chunkOff, amount);
+        count -= amount;
+        offset += amount;
+        ptr += amount;
+    }
+    return startCount - count;
+}
+
+string
+ChunkedReader::readString(Off offset) const
+{
+    std::lock_guard guard(lock);
+    string res;
+    Off end = size();
+    while (offset < end) {
+        const Chunk &chunk = getChunk(offset);
+        size_t chunkOff = offset - chunk.offset;
+        if (chunkOff >= chunk.data.size())
+            break;
+        const char *start = chunk.data.data() + chunkOff;
+        size_t avail = chunk.data.size() - chunkOff;
+        auto nul = static_cast<const char *>(memchr(start, 0, avail));
+        if (nul != nullptr) {
+            res.append(start, nul);
+            break;
+        }
+        res.append(start, avail);
+        offset += avail;
+    }
+    return res;
 }
 
 MmapReader::MmapReader(Context &c, const string &name_, int fd)
@@ -267,6 +552,19 @@ OffsetReader::read(Off off, size_t count, char *ptr) const {
     return upstream->read(off + offset, count, ptr);
 }
 
+void
+OffsetReader::readv(std::span<Segment> segments) const {
+    std::vector<Segment> upstreamSegments;
+    upstreamSegments.reserve(segments.size());
+    for (const auto &seg : segments) {
+        size_t count = seg.off >= length ? 0 : std::min(Off(seg.count), length - seg.off);
+        upstreamSegments.push_back({ seg.off + offset, count, seg.ptr, 0 });
+    }
+    upstream->readv(upstreamSegments);
+    for (size_t i = 0; i < segments.size(); ++i)
+        segments[i].rc = upstreamSegments[i].rc;
+}
+
 Reader::Off
 OffsetReader::size() const {
    return length;
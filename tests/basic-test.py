@@ -1,9 +1,12 @@
 #!/usr/bin/python3
 
+import os
 import pstack
 import platform
 
 basicBinaries = [ "basic", "basic-zlib", "basic-zlib-gnu" ]
+if os.path.exists("basic-zstd"):
+   basicBinaries.append( "basic-zstd" )
 if platform.machine() != "aarch64":
    basicBinaries.append( "basic-no-unwind" )
 
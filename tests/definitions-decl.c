@@ -0,0 +1,10 @@
+// Only declares S, gs and gfunc: their definitions are in definitions-def.c
+struct S;
+extern struct S gs;
+extern void gfunc(struct S *);
+
+void
+useDeclarations()
+{
+    gfunc(&gs);
+}
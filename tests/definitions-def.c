@@ -0,0 +1,12 @@
+struct S {
+    int a;
+    int b;
+};
+
+struct S gs = { 1, 2 };
+
+void
+gfunc(struct S *s)
+{
+    s->a++;
+}
@@ -0,0 +1,13 @@
+// Only declares ns::S, ns::gs and ns::gfunc: their definitions are in
+// definitions-ns-def.cc
+namespace ns {
+struct S;
+extern S gs;
+void gfunc(S *);
+}
+
+void
+useNsDeclarations()
+{
+    ns::gfunc(&ns::gs);
+}
@@ -0,0 +1,14 @@
+// Different members from the C struct S, so the two can't be confused.
+namespace ns {
+struct S {
+    long c;
+};
+
+S gs = { 3 };
+
+void
+gfunc(S *s)
+{
+    s->c++;
+}
+}
@@ -0,0 +1,52 @@
+// Check Dwarf::Info::findDefinitions finds each definition once, and never a
+// declaration, for C names, and for C++ names in a namespace, which GCC
+// qualifies in .debug_pubnames and .debug_pubtypes. We're built both with and
+// without -gpubnames (with PUBNAMES defined), to check both the scan of the
+// units and the name index.
+#include "libpstack/context.h"
+#include "libpstack/dwarf.h"
+#include <cassert>
+#include <iostream>
+
+extern "C" void useDeclarations();
+void useNsDeclarations();
+
+int
+main()
+{
+    pstack::Context context;
+    auto dwarf = context.findDwarf("/proc/self/exe");
+    assert(dwarf);
+#ifdef PUBNAMES
+    assert(dwarf->hasNameIndex());
+#else
+    assert(!dwarf->hasNameIndex());
+#endif
+    struct Expect { const char *name; pstack::Dwarf::Tag tag; };
+    for (auto [ name, tag ] : {
+            Expect{ "S", pstack::Dwarf::DW_TAG_structure_type },
+            Expect{ "gs", pstack::Dwarf::DW_TAG_variable },
+            Expect{ "gfunc", pstack::Dwarf::DW_TAG_subprogram },
+            Expect{ "ns::S", pstack::Dwarf::DW_TAG_structure_type },
+            Expect{ "ns::gs", pstack::Dwarf::DW_TAG_variable },
+            Expect{ "ns::gfunc", pstack::Dwarf::DW_TAG_subprogram } }) {
+        auto found = dwarf->findDefinitions(name);
+        std::cout << name << ": " << found.size() << " definitions\n";
+        assert(found.size() == 1);
+        assert(found[0].tag() == tag);
+        assert(found[0].qualifiedName() == name);
+        assert(!found[0].attribute(pstack::Dwarf::DW_AT_declaration).valid());
+    }
+    // The C and C++ structs are told apart by their members.
+    auto member = [](const pstack::Dwarf::DIE &type) {
+        for (auto child : type.children())
+            return child.name();
+        return std::string();
+    };
+    assert(member(dwarf->findDefinitions("S")[0]) == "a");
+    assert(member(dwarf->findDefinitions("ns::S")[0]) == "c");
+    assert(dwarf->findDefinitions("ns::a").empty());
+    useDeclarations();
+    useNsDeclarations();
+    return 0;
+}
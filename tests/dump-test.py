@@ -1,11 +1,13 @@
 #!/usr/bin/python3
 
+import os
 import pstack
 
 data = pstack.dumpJSON(f"../{pstack.PSTACK_BIN}")
 assert len(data) != 0
 print( f"pstack binary debug information length is {len(data)}" )
 print( f"pstack binary debug information is {data}" )
-for ex in [ "basic", "basic-zlib", "basic-zlib-gnu" ]:
+compressed = [ "basic-zstd" ] if os.path.exists("basic-zstd") else []
+for ex in [ "basic", "basic-zlib", "basic-zlib-gnu" ] + compressed:
     data = pstack.dumpJSON(f"./{ex}")
     assert len(data)
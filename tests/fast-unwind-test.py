@@ -0,0 +1,38 @@
+#!/usr/bin/python3
+
+# The fast unwind plans are used for a function once the generic unwinder has
+# been through it, so in a process with several threads, most frames are
+# unwound with them. Check they give the same stacks as the generic unwinder
+# alone, with NO_FAST_UNWIND set, for threads blocked in a system call, and
+# for threads waiting in a signal handler.
+
+import os
+import pstack
+
+def frameKey(frame):
+    # Each run is a new process, so compare addresses relative to the object.
+    symbol = frame["symbol"]["st_name"] if frame["symbol"] else None
+    source = [ (s["file"], s["line"]) for s in frame["source"] ]
+    return (frame["ip"] - frame["loadaddr"] if frame["loadaddr"] else None,
+            frame["offset"], frame["trampoline"], frame["die"], symbol, source)
+
+def stacks(cmd, env):
+    threads, _ = pstack.JSON([cmd], env=env)
+    return sorted([ frameKey(frame) for frame in thread["ti_stack"] ] for thread in threads)
+
+for cmd, threadCount in [ ("./thread", 11), ("./segvthreads", 5) ]:
+    fast = stacks(cmd, None)
+    generic = stacks(cmd, dict(os.environ, NO_FAST_UNWIND="1"))
+    print("%s: %d threads, %d frames" % (cmd, len(fast), sum(len(s) for s in fast)))
+    assert len(fast) == threadCount
+    for fastStack, genericStack in zip(fast, generic):
+        if fastStack != genericStack:
+            print("fast: %s\ngeneric: %s" % (fastStack, genericStack))
+    assert fast == generic
+
+    if cmd == "./segvthreads":
+        inHandler = [ s for s in fast if any(f[2] for f in s) ]
+        assert len(inHandler) == 4
+        for stack in inHandler:
+            dies = [ f[3] for f in stack ]
+            assert "sigsegv" in dies and "g" in dies and "f" in dies
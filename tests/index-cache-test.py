@@ -0,0 +1,36 @@
+#!/usr/bin/python3
+
+# Run pstack twice with --index-cache: the first run should save the unit
+# index for basic-no-aranges, and the second should load it, and get the same
+# stack.
+
+import json
+import os
+import subprocess
+import tempfile
+import pstack
+
+def run(cacheDir):
+    with tempfile.NamedTemporaryFile(mode="r") as out:
+        result = subprocess.run(["../%s" % pstack.PSTACK_BIN, "-v", "-j",
+                                 "--index-cache", cacheDir, "-o", out.name,
+                                 "-x", "./basic-no-aranges"],
+                                stdout=subprocess.DEVNULL, stderr=subprocess.PIPE,
+                                universal_newlines=True, check=True)
+        return json.loads(out.read()), result.stderr
+
+def frames(threads):
+    return [ frame.get("die") for frame in threads[0]["ti_stack"] ]
+
+with tempfile.TemporaryDirectory() as cacheDir:
+    first, log = run(cacheDir)
+    saved = [ f for f in os.listdir(cacheDir) if f.endswith(".units") ]
+    print("saved indexes: %s" % saved)
+    assert len(saved) == 1
+    assert "loaded unit index" not in log
+
+    second, log = run(cacheDir)
+    loaded = [ line for line in log.splitlines() if "loaded unit index from" in line ]
+    assert len(loaded) == 1 and os.path.join(cacheDir, saved[0]) in loaded[0]
+    assert frames(first) == frames(second)
+    assert "main" in frames(second)
@@ -0,0 +1,114 @@
+// Check Lz4Reader's block cache and prefetching: reads that alternate between
+// two blocks, and sequential reads that start the prefetches, with a budget of
+// one block, none, and the default, from one thread and several at once. The
+// cache must stay within its budget, keeping at most the one block it's using
+// beyond it, and every read must give the original content.
+#include "libpstack/lz4reader.h"
+#include <lz4frame.h>
+#include <cassert>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace pstack;
+
+namespace {
+
+constexpr size_t blockSize = 64 * 1024;
+
+std::string
+content()
+{
+    std::mt19937 rng(1);
+    static const char *words[] = { "frame", "unwind", "stack", "thread", "register", " ", "\n" };
+    std::string raw;
+    while (raw.size() < 40 * blockSize + 1000)
+        raw += words[rng() % (sizeof words / sizeof words[0])];
+    return raw;
+}
+
+std::string
+compress(const std::string &raw)
+{
+    LZ4F_preferences_t prefs {};
+    prefs.frameInfo.blockSizeID = LZ4F_max64KB;
+    prefs.frameInfo.blockMode = LZ4F_blockIndependent;
+    std::string compressed(LZ4F_compressFrameBound(raw.size(), &prefs), '\0');
+    size_t size = LZ4F_compressFrame(compressed.data(), compressed.size(), raw.data(), raw.size(), &prefs);
+    assert(!LZ4F_isError(size));
+    compressed.resize(size);
+    return compressed;
+}
+
+void
+check(const Lz4Reader &reader, const std::string &raw, size_t budget, size_t off, size_t len)
+{
+    len = std::min(len, raw.size() - off);
+    std::string buf(len, '\0');
+    assert(reader.read(off, len, buf.data()) == len);
+    assert(buf == raw.substr(off, len));
+    assert(reader.cached_bytes() <= std::max(budget, blockSize));
+}
+
+// Read the content in pieces that don't line up with the blocks.
+void
+sequential(const Lz4Reader &reader, const std::string &raw, size_t budget, size_t start)
+{
+    for (size_t off = start; off < raw.size(); off += 10000)
+        check(reader, raw, budget, off, 10000);
+}
+
+void
+alternating(const Lz4Reader &reader, const std::string &raw, size_t budget, size_t first)
+{
+    for (int i = 0; i < 20; ++i) {
+        size_t block = first + i % 2;
+        check(reader, raw, budget, block * blockSize + i * 100, 5000);
+    }
+    // Across the boundary between them, too.
+    for (int i = 0; i < 10; ++i)
+        check(reader, raw, budget, (first + 1) * blockSize - 2000, 4000);
+}
+
+}
+
+int
+main()
+{
+    std::string raw = content();
+    std::string compressed = compress(raw);
+    auto upstream = std::make_shared<MemReader>("lz4", compressed.size(), compressed.data());
+
+    for (size_t budget : { blockSize, size_t(0), Lz4Reader::kDefaultCacheBudget }) {
+        {
+            Lz4Reader reader(upstream, budget);
+            assert(reader.size() == raw.size());
+            alternating(reader, raw, budget, 3);
+            sequential(reader, raw, budget, 0);
+            alternating(reader, raw, budget, 10);
+            std::cout << "budget " << budget << ": " << reader.cached_bytes() << " bytes cached\n";
+        }
+        {
+            // Several threads at once, some reading sequentially, and so
+            // prefetching, and some alternating, with one reader shared by
+            // all of them.
+            Lz4Reader reader(upstream, budget);
+            std::vector<std::thread> threads;
+            for (size_t i = 0; i < 4; ++i) {
+                threads.emplace_back([&, i] {
+                    for (int pass = 0; pass < 3; ++pass) {
+                        if (i % 2 == 0)
+                            sequential(reader, raw, budget, i * 7 * blockSize + pass * 3000);
+                        else
+                            alternating(reader, raw, budget, i * 5 + pass);
+                    }
+                });
+            }
+            for (auto &thread : threads)
+                thread.join();
+        }
+    }
+    return 0;
+}
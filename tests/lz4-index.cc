@@ -0,0 +1,159 @@
+// Check Lz4Reader reads an lz4-compressed core the same with and without the
+// block index that "pstack --lz4-index" appends, and falls back to scanning
+// the blocks if the index is damaged.
+//
+// The "core" is our own executable, followed by random data (so some blocks
+// are stored uncompressed), and some text, compressed with 64KiB independent
+// blocks. We're passed the pstack binary to index it with.
+#include "libpstack/context.h"
+#include "libpstack/elf.h"
+#include "libpstack/lz4reader.h"
+#include <lz4frame.h>
+#include <cassert>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+
+using namespace pstack;
+
+namespace {
+
+std::string
+readFile(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void
+writeFile(const std::string &path, const std::string &data)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), data.size());
+    assert(out);
+}
+
+std::string
+content()
+{
+    std::string raw = readFile("/proc/self/exe");
+    std::mt19937 rng(1);
+    for (int i = 0; i < 300 * 1024; ++i)
+        raw += char(rng());
+    while (raw.size() < 3 * 1024 * 1024)
+        raw += "frame unwind stack thread register section symbol\n";
+    raw.resize(raw.size() - 12345); // so the last block is partial.
+    return raw;
+}
+
+std::string
+compress(const std::string &raw, bool checksums)
+{
+    LZ4F_preferences_t prefs {};
+    prefs.frameInfo.blockSizeID = LZ4F_max64KB;
+    prefs.frameInfo.blockMode = LZ4F_blockIndependent;
+    prefs.frameInfo.blockChecksumFlag = checksums ? LZ4F_blockChecksumEnabled : LZ4F_noBlockChecksum;
+    prefs.frameInfo.contentChecksumFlag = checksums ? LZ4F_contentChecksumEnabled : LZ4F_noContentChecksum;
+    std::string compressed(LZ4F_compressFrameBound(raw.size(), &prefs), '\0');
+    size_t size = LZ4F_compressFrame(compressed.data(), compressed.size(), raw.data(), raw.size(), &prefs);
+    assert(!LZ4F_isError(size));
+    compressed.resize(size);
+    return compressed;
+}
+
+// Read all of the content, and pieces of it at random.
+void
+checkReads(const Reader &reader, const std::string &raw)
+{
+    assert(reader.size() == raw.size());
+    std::string all(raw.size(), '\0');
+    assert(reader.read(0, all.size(), all.data()) == all.size());
+    assert(all == raw);
+    std::mt19937 rng(2);
+    for (int i = 0; i < 500; ++i) {
+        size_t off = rng() % raw.size();
+        size_t len = std::min(size_t(rng() % (200 * 1024)), raw.size() - off);
+        std::string buf(len, '\0');
+        assert(reader.read(off, len, buf.data()) == len);
+        assert(buf == raw.substr(off, len));
+    }
+}
+
+// Open the file, check it's indexed or not as expected, and read it.
+void
+checkFile(Context &context, const std::string &path, const std::string &raw, bool indexed)
+{
+    Lz4Reader reader(std::make_shared<FileReader>(context, path));
+    assert(reader.indexed() == indexed);
+    checkReads(reader, raw);
+}
+
+void
+lz4Index(const std::string &pstack, const std::string &path)
+{
+    int rc = system((pstack + " --lz4-index " + path).c_str());
+    assert(rc == 0);
+}
+
+}
+
+int
+main(int argc, char *argv[])
+{
+    assert(argc == 2);
+    std::string pstack = argv[1];
+    Context context;
+    std::string raw = content();
+
+    for (bool checksums : { false, true }) {
+        std::string path = checksums ? "lz4-index-checksums.lz4" : "lz4-index.lz4";
+        std::string compressed = compress(raw, checksums);
+        writeFile(path, compressed);
+        checkFile(context, path, raw, false);
+
+        // Index the file, and check indexing it again leaves it alone.
+        lz4Index(pstack, path);
+        std::string indexed = readFile(path);
+        assert(indexed.size() > compressed.size());
+        assert(indexed.compare(0, compressed.size(), compressed) == 0);
+        checkFile(context, path, raw, true);
+        lz4Index(pstack, path);
+        assert(readFile(path) == indexed);
+
+        // A damaged index is ignored: the trailer's magic, its size, or an
+        // entry pointing past the lz4 frame.
+        std::string damaged = "lz4-index-damaged.lz4";
+        writeFile(damaged, indexed.substr(0, indexed.size() - 1) + '\0');
+        checkFile(context, damaged, raw, false);
+        std::string badSize = indexed;
+        badSize[badSize.size() - 8] += 16;
+        writeFile(damaged, badSize);
+        checkFile(context, damaged, raw, false);
+        std::string badEntry = indexed;
+        badEntry[compressed.size() + 32 + 7] = 0x7f;
+        writeFile(damaged, badEntry);
+        checkFile(context, damaged, raw, false);
+        std::cout << path << ": " << compressed.size() << " bytes compressed, "
+            << indexed.size() - compressed.size() << " bytes of index\n";
+
+        // Indexing a damaged file appends a good index after the bad one.
+        lz4Index(pstack, damaged);
+        checkFile(context, damaged, raw, true);
+        remove(damaged.c_str());
+
+        // The content is an ELF image: check it reads the same through the
+        // context, as a core would.
+        Elf::Object elf(context, context.loadFile(path));
+        auto self = context.openImage("/proc/self/exe");
+        assert(elf.getHeader().e_shnum == self->getHeader().e_shnum);
+        auto &text = elf.getSection(".text", SHT_PROGBITS);
+        auto &selfText = self->getSection(".text", SHT_PROGBITS);
+        assert(text && selfText);
+        assert(text.io()->readString(0) == selfText.io()->readString(0));
+        remove(path.c_str());
+    }
+    return 0;
+}
@@ -11,12 +11,25 @@ PSTACK_BIN = os.environ.get("PSTACK_BIN", "pstack")
 
 CORE_STRATEGY = os.environ.get("PSTACK_CORE_STRATEGY", "child")
 
-def _run(cmd, mode, strategy ):
+LIVE_MEMORY = os.environ.get("PSTACK_LIVE_MEMORY")
+SNAPSHOT = os.environ.get("PSTACK_SNAPSHOT")
+JOBS = os.environ.get("PSTACK_JOBS")
+PREFETCH = os.environ.get("PSTACK_PREFETCH")
+
+def _run(cmd, mode, strategy, env=None):
     pstackArgs = ["../%s" % PSTACK_BIN, mode ]
+    if LIVE_MEMORY is not None:
+        pstackArgs += [ "--live-memory", LIVE_MEMORY ]
+    if SNAPSHOT is not None:
+        pstackArgs += [ "--snapshot", SNAPSHOT ]
+    if JOBS is not None:
+        pstackArgs += [ "--jobs", JOBS ]
+    if PREFETCH is not None:
+        pstackArgs += [ "--prefetch" ]
     if strategy == "core":
         with coremonitor.CoreMonitor(cmd) as cm:
             pstackArgs.append(cm.core())
-            pstackOutput = subprocess.check_output(pstackArgs, universal_newlines=True)
+            pstackOutput = subprocess.check_output(pstackArgs, universal_newlines=True, env=env)
             return pstackOutput, cm.output
     elif strategy == "child":
         fd, fname = tempfile.mkstemp()
@@ -25,22 +38,22 @@ def _run(cmd, mode, strategy ):
         pstackArgs.append(fname)
         pstackArgs.append("-x")
         pstackArgs.append(" ".join(cmd))
-        programOutput = subprocess.check_output(pstackArgs, universal_newlines=True)
+        programOutput = subprocess.check_output(pstackArgs, universal_newlines=True, env=env)
         os.remove( fname )
         return pstackOutput.read(), programOutput
     elif strategy == "live":
         with subprocess.Popen( cmd, stdout=subprocess.PIPE) as proc:
             procOutput = proc.stdout.read(1000)
             pstackArgs.append( str( proc.pid ) )
-            pstackOutput = subprocess.check_output(pstackArgs, universal_newlines=True)
+            pstackOutput = subprocess.check_output(pstackArgs, universal_newlines=True, env=env)
             os.kill(proc.pid, signal.SIGINT)
             return pstackOutput, procOutput
 
-def TEXT(cmd, strategy=CORE_STRATEGY):
-    return _run(cmd, mode="-a", strategy=strategy)
+def TEXT(cmd, strategy=CORE_STRATEGY, env=None):
+    return _run(cmd, mode="-a", strategy=strategy, env=env)
 
-def JSON(cmd, strategy=CORE_STRATEGY):
-    pstack, target = _run(cmd, mode="-j", strategy=strategy)
+def JSON(cmd, strategy=CORE_STRATEGY, env=None):
+    pstack, target = _run(cmd, mode="-j", strategy=strategy, env=env)
     return json.loads(pstack), target
 
 def dumpJSON(image):
@@ -0,0 +1,51 @@
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+// Several threads fault, and wait in the SIGSEGV handler, so the unwinder
+// passes through the same functions, and the signal frame, once per thread.
+// The main thread aborts once they all have.
+
+#define THREADS 4
+
+void my_abort();
+
+static int faulted;
+
+static void
+sigsegv(int segv)
+{
+    (void)segv;
+    __atomic_add_fetch(&faulted, 1, __ATOMIC_SEQ_CST);
+    for (;;)
+        pause();
+}
+
+static void g(int a)
+{
+    (void)a;
+    *(volatile int *)1 = 0;
+    pause();
+}
+
+static void *
+f(void *arg)
+{
+    (void)arg;
+    g(1);
+    pause();
+    return 0;
+}
+
+int
+main()
+{
+    pthread_t threads[THREADS];
+    signal(SIGSEGV, sigsegv);
+    for (int i = 0; i < THREADS; ++i)
+        pthread_create(&threads[i], 0, f, 0);
+    while (__atomic_load_n(&faulted, __ATOMIC_SEQ_CST) != THREADS)
+        usleep(1000);
+    my_abort();
+    return 0;
+}
@@ -0,0 +1,107 @@
+// Check StreamingInflateReader gives the same content as inflating up front,
+// reading forwards, backwards, and at random through its checkpoints. We're
+// linked with zlib-compressed debug sections, so we also check those read the
+// same when Options::lazyDecompressSize sends them through it.
+#include "libpstack/context.h"
+#include "libpstack/elf.h"
+#include "libpstack/inflatereader.h"
+#include <zlib.h>
+#include <cassert>
+#include <iostream>
+#include <random>
+#include <string>
+
+using namespace pstack;
+
+namespace {
+
+std::string
+readAll(const Reader &reader, size_t size)
+{
+    std::string data(size, '\0');
+    size_t got = reader.read(0, size, data.data());
+    assert(got == size);
+    return data;
+}
+
+void
+check(const Reader &reader, const std::string &raw, Reader::Off off, size_t len)
+{
+    len = std::min(len, raw.size() - off);
+    std::string buf(len, '\0');
+    size_t got = reader.read(off, len, buf.data());
+    assert(got == len);
+    assert(buf == raw.substr(off, len));
+}
+
+void
+checkReader()
+{
+    // Text from a small vocabulary, so deflate finds plenty of matches.
+    static const char *words[] = { "frame", "unwind", "stack", "thread", "register",
+        "section", "symbol", "inflate", "checkpoint", "window", "\n", " " };
+    std::mt19937 rng(1);
+    std::string raw;
+    while (raw.size() < 8 * 1024 * 1024)
+        raw += words[rng() % (sizeof words / sizeof words[0])];
+
+    uLongf compressedSize = compressBound(raw.size());
+    std::string compressed(compressedSize, '\0');
+    int rc = compress2(reinterpret_cast<Bytef *>(compressed.data()), &compressedSize,
+          reinterpret_cast<const Bytef *>(raw.data()), raw.size(), 6);
+    assert(rc == Z_OK);
+    compressed.resize(compressedSize);
+    auto upstream = std::make_shared<MemReader>("deflated", compressed.size(), compressed.data());
+
+    // Checkpoint often, and cache little, so most reads restart from one.
+    StreamingInflateReader reader(raw.size(), upstream, 64 * 1024, 0);
+    const size_t step = 100 * 1000;
+    for (size_t off = 0; off < raw.size(); off += step)
+        check(reader, raw, off, step);
+    size_t checkpoints = reader.checkpointCount();
+    std::cout << checkpoints << " checkpoints\n";
+    assert(checkpoints > 8);
+    for (size_t off = raw.size(); off > step; off -= step)
+        check(reader, raw, off - step, step);
+    for (int i = 0; i < 200; ++i)
+        check(reader, raw, rng() % raw.size(), rng() % (3 * 1024 * 1024));
+    assert(reader.readString(raw.size() - 5) == raw.substr(raw.size() - 5));
+    // Going back over the content records no checkpoints twice.
+    assert(reader.checkpointCount() == checkpoints);
+}
+
+void
+checkSections()
+{
+    Context eager;
+    Context lazy;
+    lazy.options.lazyDecompressSize = 0;
+    auto eagerElf = eager.openImage("/proc/self/exe");
+    auto lazyElf = lazy.openImage("/proc/self/exe");
+    size_t compressed = 0;
+    for (auto name : { ".debug_info", ".debug_abbrev", ".debug_line", ".debug_str" }) {
+        auto &eagerSec = eagerElf->getSection(name, SHT_PROGBITS);
+        auto &lazySec = lazyElf->getSection(name, SHT_PROGBITS);
+        assert(eagerSec && lazySec);
+        if ((lazySec.shdr.sh_flags & SHF_COMPRESSED) == 0)
+            continue;
+        ++compressed;
+        auto eagerIo = eagerSec.io();
+        auto lazyIo = lazySec.io();
+        assert(dynamic_cast<const StreamingInflateReader *>(lazyIo.get()) != nullptr);
+        assert(eagerIo->size() == lazyIo->size());
+        assert(readAll(*eagerIo, eagerIo->size()) == readAll(*lazyIo, lazyIo->size()));
+    }
+    std::cout << compressed << " compressed sections\n";
+    assert(compressed != 0);
+}
+
+}
+
+int
+main()
+{
+    checkReader();
+    checkSections();
+    return 0;
+}
@@ -0,0 +1,230 @@
+// Check ZstdReader records checkpoints within zstd frames, and reads the same
+// content forwards, backwards, and at random through them: for a frame that
+// doesn't record its size, and so is decoded when we scan the frames, one
+// that does, one with a window smaller than a block, flushed often so it has
+// lots of small blocks, and one small enough that its window covers all of
+// it. libzstd is loaded at runtime, as pstack does, to compress the content.
+// A long stream with a small checkpoint budget keeps its checkpoints under
+// the budget, thinning them out as it goes.
+//
+// With a release of libzstd ZstdReader doesn't checkpoint with, we just check
+// the reads.
+//
+// If the linker can, we're linked with zstd-compressed debug sections. Those
+// are small enough to be single frames that can't be checkpointed, so they
+// should be decoded up front even when Options::lazyDecompressSize says to
+// decode them lazily.
+#include "libpstack/context.h"
+#include "libpstack/elf.h"
+#include "libpstack/zstdreader.h"
+#include <dlfcn.h>
+#include <cassert>
+#include <iostream>
+#include <random>
+#include <string>
+
+using namespace pstack;
+
+namespace {
+
+struct ZSTD_inBuffer { const void *src; size_t size; size_t pos; };
+struct ZSTD_outBuffer { void *dst; size_t size; size_t pos; };
+enum { ZSTD_c_compressionLevel = 100, ZSTD_c_windowLog = 101 };
+enum { ZSTD_e_continue = 0, ZSTD_e_flush = 1, ZSTD_e_end = 2 };
+
+struct Compressor {
+    void *(*createCCtx)();
+    size_t (*freeCCtx)(void *);
+    size_t (*setParameter)(void *, int, int);
+    size_t (*setPledgedSrcSize)(void *, unsigned long long);
+    size_t (*compressStream2)(void *, ZSTD_outBuffer *, ZSTD_inBuffer *, int);
+    unsigned (*isError)(size_t);
+    Compressor(void *handle)
+        : createCCtx(reinterpret_cast<decltype(createCCtx)>(dlsym(handle, "ZSTD_createCCtx")))
+        , freeCCtx(reinterpret_cast<decltype(freeCCtx)>(dlsym(handle, "ZSTD_freeCCtx")))
+        , setParameter(reinterpret_cast<decltype(setParameter)>(dlsym(handle, "ZSTD_CCtx_setParameter")))
+        , setPledgedSrcSize(reinterpret_cast<decltype(setPledgedSrcSize)>(dlsym(handle, "ZSTD_CCtx_setPledgedSrcSize")))
+        , compressStream2(reinterpret_cast<decltype(compressStream2)>(dlsym(handle, "ZSTD_compressStream2")))
+        , isError(reinterpret_cast<decltype(isError)>(dlsym(handle, "ZSTD_isError")))
+    {
+        assert(createCCtx && freeCCtx && setParameter && setPledgedSrcSize && compressStream2 && isError);
+    }
+
+    // Compress "raw" as one frame, with a window of 1 << windowLog bytes. If
+    // "sized", the frame records its content size, otherwise we feed it in
+    // pieces of "piece" bytes, like a stream of unknown length, flushing
+    // after each if "flush" is set.
+    std::string compress(const std::string &raw, bool sized, int windowLog = 17,
+          size_t piece = 100000, bool flush = false) const {
+        void *cctx = createCCtx();
+        setParameter(cctx, ZSTD_c_compressionLevel, 3);
+        setParameter(cctx, ZSTD_c_windowLog, windowLog);
+        if (sized) {
+            setPledgedSrcSize(cctx, raw.size());
+            piece = raw.size();
+        }
+        std::string compressed;
+        char buf[65536];
+        for (size_t off = 0;; off += piece) {
+            bool last = off + piece >= raw.size();
+            ZSTD_inBuffer in { raw.data() + off, std::min(piece, raw.size() - off), 0 };
+            int mode = last ? ZSTD_e_end : flush ? ZSTD_e_flush : ZSTD_e_continue;
+            for (;;) {
+                ZSTD_outBuffer out { buf, sizeof buf, 0 };
+                size_t rc = compressStream2(cctx, &out, &in, mode);
+                assert(!isError(rc));
+                compressed.append(buf, out.pos);
+                if (mode == ZSTD_e_continue ? in.pos == in.size : rc == 0)
+                    break;
+            }
+            if (last)
+                break;
+        }
+        freeCCtx(cctx);
+        return compressed;
+    }
+};
+
+void
+check(const Reader &reader, const std::string &raw, Reader::Off off, size_t len)
+{
+    len = std::min(len, raw.size() - off);
+    std::string buf(len, '\0');
+    size_t got = reader.read(off, len, buf.data());
+    assert(got == len);
+    assert(buf == raw.substr(off, len));
+}
+
+std::string
+content(size_t size)
+{
+    // Text from a small vocabulary, so there are plenty of matches.
+    static const char *words[] = { "frame", "unwind", "stack", "thread", "register",
+        "section", "symbol", "window", "checkpoint", "block", "\n", " " };
+    std::mt19937 rng(size);
+    std::string raw;
+    while (raw.size() < size)
+        raw += words[rng() % (sizeof words / sizeof words[0])];
+    return raw;
+}
+
+// Returns the number of checkpoints recorded.
+size_t
+checkReader(const std::string &compressed, const std::string &raw, bool sized)
+{
+    auto upstream = std::make_shared<MemReader>("zstd", compressed.size(), compressed.data());
+    bool checkpointed = zstdCheckpointsAvailable();
+    assert(zstdCanCheckpoint(*upstream) == (checkpointed && raw.size() > 128 * 1024));
+    // Checkpoint often, and cache little, so most reads restart from one.
+    ZstdReader reader(upstream, 64 * 1024, 0);
+    assert(reader.size() == raw.size());
+    size_t scanned = reader.checkpointCount();
+    std::cout << (sized ? "sized" : "streamed") << " frame of " << raw.size() << " bytes: "
+        << scanned << " checkpoints after scanning, ";
+    // Only a frame we had to decode to find its size has checkpoints yet.
+    assert(sized || !checkpointed ? scanned == 0 : scanned != 0);
+
+    const size_t step = 100 * 1000;
+    for (size_t off = 0; off < raw.size(); off += step)
+        check(reader, raw, off, step);
+    size_t checkpoints = reader.checkpointCount();
+    std::cout << checkpoints << " after reading\n";
+    assert(checkpoints >= scanned);
+    for (size_t off = raw.size(); off > 0; off -= std::min(off, step))
+        check(reader, raw, off - std::min(off, step), step);
+    std::mt19937 rng(2);
+    for (int i = 0; i < 200; ++i)
+        check(reader, raw, rng() % raw.size(), rng() % (3 * 1024 * 1024));
+    assert(reader.readString(raw.size() - 5) == raw.substr(raw.size() - 5));
+    // Going back over the content records no checkpoints twice.
+    assert(reader.checkpointCount() == checkpoints);
+    return checkpoints;
+}
+
+// Decode a long stream with a window of 4KiB, so each checkpoint holds a
+// segment of at least 8KiB, plus a decoder. Without a budget, checkpointing
+// every 64KiB would record 256 of them.
+void
+checkBudget(const Compressor &zstd)
+{
+    std::string raw = content(16 * 1024 * 1024);
+    std::string compressed = zstd.compress(raw, false, 12);
+    auto upstream = std::make_shared<MemReader>("zstd", compressed.size(), compressed.data());
+    const size_t segment = 2 * 4096;
+    const size_t budget = 4 * 1024 * 1024;
+    ZstdReader reader(upstream, 64 * 1024, 0, budget);
+    assert(reader.size() == raw.size());
+    size_t scanned = reader.checkpointCount();
+    std::mt19937 rng(3);
+    for (int i = 0; i < 200; ++i) {
+        check(reader, raw, rng() % raw.size(), rng() % (256 * 1024));
+        assert(reader.checkpointCount() <= budget / segment);
+        assert(reader.checkpointMemory() <= budget);
+    }
+    std::cout << "streamed frame of " << raw.size() << " bytes with a budget of "
+        << budget << ": " << scanned << " checkpoints after scanning, "
+        << reader.checkpointCount() << " after reading\n";
+    assert(scanned <= budget / segment);
+    assert(zstdCheckpointsAvailable() ? scanned >= 4 && scanned < 256 : scanned == 0);
+}
+
+std::string
+readAll(const Reader &reader)
+{
+    std::string data(reader.size(), '\0');
+    size_t got = reader.read(0, data.size(), data.data());
+    assert(got == data.size());
+    return data;
+}
+
+void
+checkSections()
+{
+    Context eager;
+    Context lazy;
+    lazy.options.lazyDecompressSize = 0;
+    auto eagerElf = eager.openImage("/proc/self/exe");
+    auto lazyElf = lazy.openImage("/proc/self/exe");
+    size_t compressed = 0;
+    for (auto name : { ".debug_info", ".debug_abbrev", ".debug_line", ".debug_str" }) {
+        auto &eagerSec = eagerElf->getSection(name, SHT_PROGBITS);
+        auto &lazySec = lazyElf->getSection(name, SHT_PROGBITS);
+        assert(eagerSec && lazySec);
+        if ((lazySec.shdr.sh_flags & SHF_COMPRESSED) == 0)
+            continue;
+        ++compressed;
+        auto lazyIo = lazySec.io();
+        assert(dynamic_cast<const ZstdMemReader *>(lazyIo.get()) != nullptr);
+        assert(readAll(*eagerSec.io()) == readAll(*lazyIo));
+    }
+    std::cout << compressed << " compressed sections\n";
+#ifdef ZSTD_SECTIONS
+    assert(compressed != 0);
+#endif
+}
+
+}
+
+int
+main()
+{
+    if (!zstdAvailable()) {
+        std::cout << "zstd not available, skipping\n";
+        return 0;
+    }
+    Compressor zstd(dlopen("libzstd.so.1", RTLD_LAZY));
+    size_t minCheckpoints = zstdCheckpointsAvailable() ? 4 : 0;
+    std::string large = content(8 * 1024 * 1024);
+    assert(checkReader(zstd.compress(large, false), large, false) >= minCheckpoints);
+    assert(checkReader(zstd.compress(large, true), large, true) >= minCheckpoints);
+    // With a 4KiB window, and a flush every 3000 bytes, blocks are smaller
+    // than 128KiB, and so are the segments of decoded data we keep.
+    std::string medium = content(4 * 1024 * 1024);
+    assert(checkReader(zstd.compress(medium, false, 12, 3000, true), medium, false) >= minCheckpoints);
+    // A frame that fits in its window is decoded from the start every time.
+    std::string small = content(100 * 1000);
+    assert(checkReader(zstd.compress(small, true), small, true) == 0);
+    checkBudget(zstd);
+    checkSections();
+    return 0;
+}
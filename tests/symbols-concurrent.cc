@@ -0,0 +1,42 @@
+// Check an object's symbol tables and name index can be loaded by several
+// threads at once, as when --jobs unwinds threads through the same library
+// and looks up its signal trampolines by name. Run under -fsanitize=thread
+// to catch races.
+#include "libpstack/context.h"
+#include "libpstack/elf.h"
+#include <cassert>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+extern "C" int
+concurrentSymbol()
+{
+    return 42;
+}
+
+int
+main()
+{
+    pstack::Context context;
+    for (int round = 0; round < 20; ++round) {
+        // A new object each time, so its tables start unloaded.
+        auto obj = context.openImage("/proc/self/exe");
+        std::vector<std::thread> threads;
+        std::vector<pstack::Elf::Addr> found(8);
+        for (size_t i = 0; i < found.size(); ++i) {
+            threads.emplace_back([&, i] {
+                auto [ sym, idx ] = obj->findDebugSymbol("concurrentSymbol");
+                assert(idx != 0);
+                found[i] = sym.st_value;
+                assert(obj->dynamicSymbols().size() != 0);
+            });
+        }
+        for (auto &thread : threads)
+            thread.join();
+        for (auto addr : found)
+            assert(addr == found[0] && addr != 0);
+    }
+    std::cout << "found concurrentSymbol from several threads\n";
+    return 0;
+}
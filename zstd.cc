@@ -0,0 +1,659 @@
+#include "libpstack/zstdreader.h"
+#include "libpstack/stringify.h"
+
+#include <assert.h>
+#include <dlfcn.h>
+#include <endian.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+
+namespace {
+
+// We don't need zstd.h: these buffer structures are part of libzstd's stable
+// ABI.
+struct ZSTD_inBuffer {
+    const void *src;
+    size_t size;
+    size_t pos;
+};
+
+struct ZSTD_outBuffer {
+    void *dst;
+    size_t size;
+    size_t pos;
+};
+
+struct Zstd {
+    void *      (*createDStream)();
+    size_t      (*freeDStream)(void *);
+    size_t      (*initDStream)(void *);
+    size_t      (*decompressStream)(void *, ZSTD_outBuffer *, ZSTD_inBuffer *);
+    unsigned    (*isError)(size_t);
+    const char *(*getErrorName)(size_t);
+    // The buffer-less API, that ZstdReader uses so it can copy the decoder.
+    void *      (*createDCtx)();
+    size_t      (*freeDCtx)(void *);
+    size_t      (*decompressBegin)(void *);
+    size_t      (*nextSrcSizeToDecompress)(void *);
+    int         (*nextInputType)(void *);
+    size_t      (*decompressContinue)(void *, void *, size_t, const void *, size_t);
+    // Only used to copy the decoder for checkpoints, with
+    // checkpointsSupported below.
+    unsigned    (*versionNumber)();
+    void        (*copyDCtx)(void *, const void *);
+    size_t      (*sizeof_DCtx)(const void *);
+    bool        checkpointsSupported;
+};
+
+// ZSTD_nextInputType_e: the next input is a block header, so we're between
+// blocks.
+constexpr int nextInputBlockHeader = 1;
+constexpr size_t maxBlockSize = 128 * 1024; // ZSTD_BLOCKSIZE_MAX
+
+// The releases of libzstd whose ZSTD_DCtx layout DCtx::copy is known to
+// match. For others, we don't checkpoint within frames.
+constexpr unsigned minCheckpointVersion = 10504; // 1.5.4
+constexpr unsigned maxCheckpointVersion = 10506; // 1.5.6
+
+const Zstd *loadZstd() {
+    static Zstd zstd;
+    static const Zstd *result = [] () -> const Zstd * {
+        void *handle = dlopen("libzstd.so.1", RTLD_LAZY | RTLD_GLOBAL);
+        if (!handle)
+            return nullptr;
+#define LOAD(name) zstd.name = reinterpret_cast<decltype(zstd.name)>(dlsym(handle, "ZSTD_" #name))
+        LOAD(createDStream);
+        LOAD(freeDStream);
+        LOAD(initDStream);
+        LOAD(decompressStream);
+        LOAD(isError);
+        LOAD(getErrorName);
+        LOAD(createDCtx);
+        LOAD(freeDCtx);
+        LOAD(decompressBegin);
+        LOAD(nextSrcSizeToDecompress);
+        LOAD(nextInputType);
+        LOAD(decompressContinue);
+        LOAD(versionNumber);
+        LOAD(copyDCtx);
+        LOAD(sizeof_DCtx);
+#undef LOAD
+        if (!zstd.createDStream || !zstd.freeDStream || !zstd.initDStream ||
+                !zstd.decompressStream || !zstd.isError || !zstd.getErrorName ||
+                !zstd.createDCtx || !zstd.freeDCtx || !zstd.decompressBegin ||
+                !zstd.nextSrcSizeToDecompress || !zstd.nextInputType ||
+                !zstd.decompressContinue) {
+            dlclose(handle);
+            return nullptr;
+        }
+        if (zstd.versionNumber && zstd.copyDCtx && zstd.sizeof_DCtx) {
+            unsigned version = zstd.versionNumber();
+            zstd.checkpointsSupported = version >= minCheckpointVersion
+                && version <= maxCheckpointVersion;
+        }
+        return &zstd;
+    }();
+    return result;
+}
+
+// A decompression context for the buffer-less API.
+class DCtx {
+    void *ctx;
+public:
+    DCtx() : ctx(loadZstd()->createDCtx()) {
+        if (ctx == nullptr)
+            throw (pstack::Exception() << "can't create zstd decompression context");
+    }
+    ~DCtx() { loadZstd()->freeDCtx(ctx); }
+    DCtx(const DCtx &) = delete;
+    DCtx &operator = (const DCtx &) = delete;
+    void *get() const { return ctx; }
+
+    // Make this a copy of "from", able to carry on decoding from where it is.
+    // Only for the libzstd releases in checkpointsSupported.
+    //
+    // ZSTD_copyDCtx (lib/decompress/zstd_decompress.c) is a memcpy of the
+    // context up to its input buffer, so the pointers at the start of it to
+    // the entropy tables in use still point into "from" if the tables were
+    // built there. Those are the first four members of struct ZSTD_DCtx_s in
+    // lib/decompress/zstd_decompress_internal.h: LLTptr, MLTptr, OFTptr and
+    // HUFptr. Point them at our copies of the tables.
+    void copy(const DCtx &from) {
+        auto *zstd = loadZstd();
+        assert(zstd->checkpointsSupported);
+        zstd->copyDCtx(ctx, from.ctx);
+        auto base = reinterpret_cast<uintptr_t>(from.ctx);
+        auto size = zstd->sizeof_DCtx(from.ctx);
+        auto *tablePtrs = static_cast<uintptr_t *>(ctx); // LLTptr, MLTptr, OFTptr, HUFptr
+        for (size_t i = 0; i < 4; ++i)
+            if (tablePtrs[i] - base < size)
+                tablePtrs[i] = tablePtrs[i] - base + reinterpret_cast<uintptr_t>(ctx);
+    }
+};
+
+constexpr uint32_t frameMagic = 0xfd2fb528;
+constexpr uint32_t skippableMagic = 0x184d2a50; // low 4 bits are free.
+constexpr uint32_t seekTableMagic = 0x184d2a5e;
+constexpr uint32_t seekableFooterMagic = 0x8f92eab1;
+constexpr size_t seekFooterSize = 9;
+constexpr pstack::Reader::Off unknownSize = std::numeric_limits<pstack::Reader::Off>::max();
+
+uint32_t
+getLE32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof v);
+    return le32toh(v);
+}
+
+struct FrameHeader {
+    unsigned size; // bytes in the header.
+    pstack::Reader::Off contentSize; // unknownSize if not recorded.
+    pstack::Reader::Off windowSize;
+    bool hasChecksum;
+};
+
+// "header" is the first 18 bytes of the frame (the longest frame header),
+// padded with zeroes if the content is shorter.
+FrameHeader
+parseFrameHeader(const unsigned char *header)
+{
+    uint8_t descriptor = header[4];
+    unsigned fcsFlag = descriptor >> 6;
+    bool singleSegment = (descriptor & 0x20) != 0;
+    static const unsigned dictIdSizes[] = { 0, 1, 2, 4 };
+    unsigned fcsSize = fcsFlag == 0 ? (singleSegment ? 1 : 0) : 1U << fcsFlag;
+    unsigned pos = 5 + (singleSegment ? 0 : 1) + dictIdSizes[descriptor & 3];
+    FrameHeader fh { pos + fcsSize, unknownSize, 0, (descriptor & 0x04) != 0 };
+    if (fcsSize != 0) {
+        fh.contentSize = 0;
+        for (unsigned i = fcsSize; i-- != 0; )
+            fh.contentSize = fh.contentSize << 8 | header[pos + i];
+        if (fcsSize == 2)
+            fh.contentSize += 256;
+    }
+    if (singleSegment) {
+        fh.windowSize = fh.contentSize;
+    } else {
+        unsigned windowLog = 10 + (header[5] >> 3);
+        pstack::Reader::Off windowBase = pstack::Reader::Off(1) << windowLog;
+        fh.windowSize = windowBase + (windowBase >> 3) * (header[5] & 7);
+    }
+    return fh;
+}
+
+} // namespace
+
+namespace pstack {
+
+bool zstdAvailable() {
+    return loadZstd() != nullptr;
+}
+
+bool isZstd(const Reader &reader) {
+    unsigned char magic[4];
+    return reader.size() >= sizeof magic
+        && reader.read(0, sizeof magic, reinterpret_cast<char *>(magic)) == sizeof magic
+        && getLE32(magic) == frameMagic;
+}
+
+bool zstdCheckpointsAvailable() {
+    auto *zstd = loadZstd();
+    return zstd != nullptr && zstd->checkpointsSupported;
+}
+
+bool zstdCanCheckpoint(const Reader &reader) {
+    if (!zstdCheckpointsAvailable())
+        return false;
+    unsigned char header[18] {};
+    reader.read(0, std::min(reader.size(), Reader::Off(sizeof header)),
+          reinterpret_cast<char *>(header));
+    if (getLE32(header) != frameMagic)
+        return false;
+    FrameHeader fh = parseFrameHeader(header);
+    return fh.contentSize == unknownSize || fh.windowSize < fh.contentSize;
+}
+
+ZstdMemReader::ZstdMemReader(size_t decompressedSize, const Reader &upstream)
+    : AbstractMemReader(std::string("zstd decoded content from ") + stringify(upstream))
+    , data_(decompressedSize)
+{
+    auto *zstd = loadZstd();
+    if (!zstd)
+        throw (Exception() << "zstd not available at runtime");
+    void *stream = zstd->createDStream();
+    if (stream == nullptr)
+        throw (Exception() << "can't create zstd decompression stream");
+    std::unique_ptr<void, size_t (*)(void *)> guard(stream, zstd->freeDStream);
+    zstd->initDStream(stream);
+
+    char xferbuf[65536];
+    ZSTD_outBuffer out { data_.data(), data_.size(), 0 };
+    ZSTD_inBuffer in { xferbuf, 0, 0 };
+    Off inputOffset = 0;
+    while (out.pos < out.size) {
+        if (in.pos == in.size) {
+            in.size = upstream.read(inputOffset, sizeof xferbuf, xferbuf);
+            in.pos = 0;
+            inputOffset += in.size;
+            if (in.size == 0)
+                break;
+        }
+        size_t rc = zstd->decompressStream(stream, &out, &in);
+        if (zstd->isError(rc))
+            throw (Exception() << "zstd decompression of " << upstream
+                  << " failed: " << zstd->getErrorName(rc));
+    }
+    if (out.pos != out.size)
+        throw (Exception() << "zstd content of " << upstream << " decoded to "
+              << out.pos << " bytes, expected " << out.size);
+}
+
+// A snapshot of the decoder at a block boundary. The context refers back
+// into the segment of decoded data before the boundary, so we keep that too.
+struct ZstdReader::Checkpoint {
+    Off compressed; // offset of the next input in upstream.
+    std::shared_ptr<std::vector<char>> history;
+    DCtx ctx;
+    Checkpoint(Off compressed_, std::shared_ptr<std::vector<char>> history_)
+        : compressed(compressed_), history(std::move(history_)) {}
+    // what this checkpoint holds on to, for ZstdReader::checkpointBudget.
+    size_t bytes() const { return history->size() + loadZstd()->sizeof_DCtx(ctx.get()); }
+};
+
+// The decoder writes into "segments" of a window's worth of decoded data,
+// plus room for a block. When a segment is full, we move on to another, and
+// libzstd treats the one before as a dictionary for the window it still
+// needs, so the segments are where we can take checkpoints.
+struct ZstdReader::Decoder {
+    DCtx ctx;
+    size_t frame = std::numeric_limits<size_t>::max();
+    Off compressedPos = 0; // next byte of input in upstream.
+    Off decompressedPos = 0; // output so far, relative to the frame.
+    bool done = false;
+    Off windowSize = 0;
+    size_t blockSize = 0; // the most a block of this frame can decode to.
+    size_t segmentSize = 0;
+    std::shared_ptr<std::vector<char>> segment; // being written.
+    size_t segmentUsed = 0;
+    std::shared_ptr<std::vector<char>> history; // the segment before.
+    Off chunkOffset = 0; // of the chunk being filled, relative to the frame.
+    std::vector<char> pending; // the chunk being filled.
+    std::vector<char> input;
+    Off inputOffset = 0; // offset of "input" in upstream.
+    size_t inputSize = 0;
+
+    void start(size_t frame_, Off compressed, Off decompressed, Off windowSize_, Off chunkOffset_) {
+        frame = frame_;
+        compressedPos = compressed;
+        decompressedPos = decompressed;
+        done = false;
+        windowSize = windowSize_;
+        blockSize = std::min(windowSize, Off(maxBlockSize));
+        segmentSize = windowSize + blockSize + 1;
+        segment.reset();
+        segmentUsed = 0;
+        history.reset();
+        chunkOffset = chunkOffset_;
+        pending.clear();
+    }
+    // the "want" bytes of input at compressedPos, which must be before "end".
+    const char *fetch(const Reader &upstream, Off end, size_t want) {
+        if (compressedPos < inputOffset || compressedPos + want > inputOffset + inputSize) {
+            if (end - compressedPos < want)
+                throw (Exception() << "truncated zstd frame in " << upstream);
+            inputSize = std::min(std::max(want, size_t(128 * 1024)), size_t(end - compressedPos));
+            if (input.size() < inputSize)
+                input.resize(inputSize);
+            upstream.readObj(compressedPos, input.data(), inputSize);
+            inputOffset = compressedPos;
+        }
+        const char *data = input.data() + (compressedPos - inputOffset);
+        compressedPos += want;
+        return data;
+    }
+    void nextSegment() {
+        // The segment before the last one is free to reuse, unless a
+        // checkpoint is holding on to it.
+        auto recycled = std::move(history);
+        history = std::move(segment);
+        if (recycled && recycled.use_count() == 1)
+            segment = std::move(recycled);
+        else
+            segment = std::make_shared<std::vector<char>>(segmentSize);
+        segmentUsed = 0;
+    }
+};
+
+ZstdReader::ZstdReader(Reader::csptr upstream_, Off checkpointInterval_, size_t cacheBytes,
+      size_t checkpointBudget_)
+    : ChunkedReader(1024 * 1024, cacheBytes)
+    , upstream(std::move(upstream_))
+    , checkpointInterval(checkpointInterval_)
+    , checkpointBudget(checkpointBudget_)
+{
+    if (!loadZstd())
+        throw (Exception() << "zstd not available at runtime");
+    decoder = std::make_unique<Decoder>();
+    seekable = loadSeekTable();
+    if (!seekable)
+        scanFrames();
+    if (!frames.empty())
+        decompressedSize = frames.back().decompressedOffset + frames.back().decompressedSize;
+}
+
+ZstdReader::~ZstdReader() = default;
+
+// The seekable format ends with a skippable frame holding the size of each
+// frame, and a footer with the number of frames.
+bool
+ZstdReader::loadSeekTable()
+{
+    Off fileSize = upstream->size();
+    if (fileSize < seekFooterSize + 8)
+        return false;
+    unsigned char footer[seekFooterSize];
+    upstream->readObj(fileSize - seekFooterSize, footer, sizeof footer);
+    if (getLE32(footer + 5) != seekableFooterMagic)
+        return false;
+    uint32_t frameCount = getLE32(footer);
+    uint8_t descriptor = footer[4];
+    if ((descriptor & 0x7c) != 0)
+        return false; // reserved bits set.
+    size_t entrySize = (descriptor & 0x80) ? 12 : 8;
+    Off tableSize = Off(frameCount) * entrySize + seekFooterSize;
+    if (tableSize + 8 > fileSize)
+        return false;
+    Off tableStart = fileSize - tableSize - 8;
+    unsigned char header[8];
+    upstream->readObj(tableStart, header, sizeof header);
+    if (getLE32(header) != seekTableMagic || getLE32(header + 4) != tableSize)
+        return false;
+
+    std::vector<unsigned char> entries(frameCount * entrySize);
+    upstream->readObj(tableStart + 8, entries.data(), entries.size());
+    frames.reserve(frameCount);
+    Off compressed = 0, decompressed = 0;
+    for (uint32_t i = 0; i < frameCount; ++i) {
+        const unsigned char *entry = entries.data() + i * entrySize;
+        Frame frame { compressed, getLE32(entry), decompressed, getLE32(entry + 4) };
+        compressed += frame.compressedSize;
+        decompressed += frame.decompressedSize;
+        if (frame.decompressedSize != 0)
+            frames.push_back(frame);
+    }
+    if (compressed != tableStart) {
+        frames.clear();
+        return false;
+    }
+    return true;
+}
+
+// Walk the frames, skipping over their blocks using the block headers. If a
+// frame doesn't record its decompressed size, we have to decode it to find
+// out.
+void
+ZstdReader::scanFrames()
+{
+    Off fileSize = upstream->size();
+    Off decompressed = 0;
+    for (Off offset = 0; offset + 8 <= fileSize; ) {
+        unsigned char header[18] {}; // longest frame header.
+        size_t headerLen = std::min(Off(sizeof header), fileSize - offset);
+        upstream->readObj(offset, header, headerLen);
+        uint32_t magic = getLE32(header);
+        if ((magic & 0xfffffff0) == skippableMagic) {
+            offset += 8 + getLE32(header + 4);
+            continue;
+        }
+        if (magic != frameMagic)
+            throw (Exception() << "bad zstd frame magic " << std::hex << magic
+                  << std::dec << " at offset " << offset << " of " << *upstream);
+
+        FrameHeader fh = parseFrameHeader(header);
+        Off blockOffset = offset + fh.size;
+        for (;;) {
+            unsigned char blockHeader[3];
+            upstream->readObj(blockOffset, blockHeader, sizeof blockHeader);
+            uint32_t word = blockHeader[0] | blockHeader[1] << 8 | blockHeader[2] << 16;
+            unsigned type = (word >> 1) & 3;
+            if (type == 3)
+                throw (Exception() << "reserved zstd block type at offset " << blockOffset
+                      << " of " << *upstream);
+            blockOffset += 3 + (type == 1 ? 1 : word >> 3); // RLE blocks hold one byte.
+            if (word & 1)
+                break;
+        }
+        if (fh.hasChecksum)
+            blockOffset += 4;
+        if (blockOffset > fileSize)
+            throw (Exception() << "truncated zstd frame at offset " << offset
+                  << " of " << *upstream);
+
+        frames.push_back({ offset, blockOffset - offset, decompressed, fh.contentSize });
+        if (fh.contentSize == unknownSize) {
+            decoder->frame = std::numeric_limits<size_t>::max();
+            frames.back().decompressedSize = decodeFrame(frames.size() - 1, unknownSize);
+        }
+        decompressed += frames.back().decompressedSize;
+        if (frames.back().decompressedSize == 0)
+            frames.pop_back();
+        offset = blockOffset;
+    }
+}
+
+ZstdReader::Off
+ZstdReader::decodeFrame(size_t frameIdx, Off until) const
+{
+    auto *zstd = loadZstd();
+    const Frame &frame = frames[frameIdx];
+    Decoder &d = *decoder;
+    Off frameEnd = frame.compressedOffset + frame.compressedSize;
+
+    if (d.frame != frameIdx) {
+        // Start at the beginning of the frame.
+        d.start(frameIdx, frame.compressedOffset, 0, windowSize(frame),
+              until == unknownSize ? 0 : until);
+        zstd->decompressBegin(d.ctx.get());
+    }
+
+    while (!d.done && (until == unknownSize || d.chunkOffset <= until)) {
+        size_t want = zstd->nextSrcSizeToDecompress(d.ctx.get());
+        if (want == 0) {
+            d.done = true;
+            break;
+        }
+        // Between blocks, move to a new segment if there might not be room
+        // for the next block in this one. Each segment but the first holds
+        // at least a window of data, so the point we move to a new one is a
+        // place we can take a checkpoint from.
+        if (!d.segment) {
+            d.segment = std::make_shared<std::vector<char>>(d.segmentSize);
+        } else if (d.segmentSize - d.segmentUsed <= d.blockSize
+                && zstd->nextInputType(d.ctx.get()) == nextInputBlockHeader) {
+            d.nextSegment();
+            Off absolute = frame.decompressedOffset + d.decompressedPos;
+            if (zstd->checkpointsSupported && absolute >= nextCheckpointAfter(frame, absolute))
+                addCheckpoint(frame, absolute);
+        }
+
+        const char *src = d.fetch(*upstream, frameEnd, want);
+        char *out = d.segment->data() + d.segmentUsed;
+        size_t produced = zstd->decompressContinue(d.ctx.get(), out,
+              d.segmentSize - d.segmentUsed, src, want);
+        if (zstd->isError(produced))
+            throw (Exception() << "zstd decompression failed in " << *upstream
+                  << ": " << zstd->getErrorName(produced));
+        d.segmentUsed += produced;
+
+        // Keep any output that lands in the chunk we are filling.
+        for (size_t used = 0; used != produced; ) {
+            Off pos = d.decompressedPos + used;
+            if (pos < d.chunkOffset) {
+                used = std::min(produced, size_t(d.chunkOffset - d.decompressedPos));
+                continue;
+            }
+            size_t amount = std::min(produced - used, chunkSize - d.pending.size());
+            d.pending.insert(d.pending.end(), out + used, out + used + amount);
+            used += amount;
+            if (d.pending.size() == chunkSize) {
+                addChunk(frame.decompressedOffset + d.chunkOffset, std::move(d.pending));
+                d.pending = std::vector<char>();
+                d.chunkOffset += chunkSize;
+            }
+        }
+        d.decompressedPos += produced;
+    }
+    if (!d.done)
+        return unknownSize;
+    if (!d.pending.empty())
+        addChunk(frame.decompressedOffset + d.chunkOffset, std::move(d.pending));
+    d.pending = std::vector<char>();
+    // Don't hang on to a whole frame's worth of segments.
+    d.segment.reset();
+    d.history.reset();
+    return d.decompressedPos;
+}
+
+std::vector<ZstdReader::Frame>::const_iterator
+ZstdReader::frameAt(Off offset) const
+{
+    auto frameIt = std::upper_bound(frames.begin(), frames.end(), offset,
+            [](Off off, const Frame &frame) { return off < frame.decompressedOffset; });
+    if (frameIt == frames.begin())
+        throw (Exception() << "offset " << offset << " not in any zstd frame of " << *upstream);
+    return frameIt - 1;
+}
+
+// Chunks are aligned relative to the start of their frame.
+ZstdReader::Off
+ZstdReader::chunkStart(Off offset) const
+{
+    auto frameIt = frameAt(offset);
+    return frameIt->decompressedOffset
+        + (offset - frameIt->decompressedOffset) / chunkSize * chunkSize;
+}
+
+ZstdReader::Off
+ZstdReader::windowSize(const Frame &frame) const
+{
+    unsigned char header[18] {};
+    upstream->read(frame.compressedOffset, std::min(Off(sizeof header), frame.compressedSize),
+          reinterpret_cast<char *>(header));
+    return parseFrameHeader(header).windowSize;
+}
+
+// The last checkpoint in "frame" at or before "offset", or end().
+std::map<ZstdReader::Off, ZstdReader::Checkpoint>::const_iterator
+ZstdReader::lastCheckpoint(const Frame &frame, Off offset) const
+{
+    auto cp = checkpoints.upper_bound(offset);
+    if (cp == checkpoints.begin() || std::prev(cp)->first < frame.decompressedOffset)
+        return checkpoints.end();
+    return std::prev(cp);
+}
+
+// Where in the decoded content the checkpoint after the last one at or
+// before "offset" in "frame" is due. A checkpoint holds on to a window of
+// data, so space them out more for larger windows.
+ZstdReader::Off
+ZstdReader::nextCheckpointAfter(const Frame &frame, Off offset) const
+{
+    auto cp = lastCheckpoint(frame, offset);
+    Off last = cp == checkpoints.end() ? frame.decompressedOffset : cp->first;
+    return last + std::max(checkpointInterval, 8 * decoder->windowSize);
+}
+
+// Record a checkpoint of the decoder at "offset" in the decoded content,
+// thinning out the others to make room for it if we need to.
+void
+ZstdReader::addCheckpoint(const Frame &frame, Off offset) const
+{
+    Decoder &d = *decoder;
+    size_t bytes = d.history->size() + loadZstd()->sizeof_DCtx(d.ctx.get());
+    while (checkpointBytes + bytes > checkpointBudget) {
+        if (checkpoints.empty())
+            return; // too big on its own.
+        thinCheckpoints();
+        if (offset < nextCheckpointAfter(frame, offset))
+            return;
+    }
+    auto &checkpoint = checkpoints.emplace_hint(checkpoints.upper_bound(offset),
+          std::piecewise_construct, std::forward_as_tuple(offset),
+          std::forward_as_tuple(d.compressedPos, d.history))->second;
+    checkpoint.ctx.copy(d.ctx);
+    checkpointBytes += checkpoint.bytes();
+}
+
+// Drop every other checkpoint, and space new ones twice as far apart.
+void
+ZstdReader::thinCheckpoints() const
+{
+    bool drop = false;
+    for (auto it = checkpoints.begin(); it != checkpoints.end(); drop = !drop) {
+        if (drop) {
+            checkpointBytes -= it->second.bytes();
+            it = checkpoints.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    checkpointInterval = 2 * std::max(checkpointInterval, 8 * decoder->windowSize);
+}
+
+void
+ZstdReader::decodeChunk(Off chunkOffset) const
+{
+    auto frameIt = frameAt(chunkOffset);
+    size_t frameIdx = frameIt - frames.begin();
+    Off chunkRel = chunkOffset - frameIt->decompressedOffset;
+    Decoder &d = *decoder;
+
+    // Find the last checkpoint in this frame at or before the chunk. If the
+    // decoder is between it and the chunk, we can just carry on with that.
+    auto cp = lastCheckpoint(*frameIt, chunkOffset);
+    Off cpRel = cp == checkpoints.end() ? 0 : cp->first - frameIt->decompressedOffset;
+
+    bool carryOn = d.frame == frameIdx && !d.done && d.decompressedPos >= cpRel
+        && (d.decompressedPos <= chunkRel || d.chunkOffset == chunkRel);
+    if (!carryOn) {
+        if (cp == checkpoints.end()) {
+            d.frame = std::numeric_limits<size_t>::max(); // start from the beginning.
+        } else {
+            const Checkpoint &checkpoint = cp->second;
+            d.start(frameIdx, checkpoint.compressed, cpRel, windowSize(*frameIt), chunkRel);
+            d.ctx.copy(checkpoint.ctx);
+            d.history = checkpoint.history;
+        }
+    } else if (d.chunkOffset != chunkRel) {
+        // Skip forward to the chunk we want.
+        d.pending.clear();
+        d.chunkOffset = chunkRel;
+    }
+    decodeFrame(frameIdx, chunkRel);
+}
+
+size_t
+ZstdReader::checkpointCount() const
+{
+    std::lock_guard guard(lock);
+    return checkpoints.size();
+}
+
+size_t
+ZstdReader::checkpointMemory() const
+{
+    std::lock_guard guard(lock);
+    return checkpointBytes;
+}
+
+void
+ZstdReader::describe(std::ostream &os) const
+{
+    os << "zstd compressed " << *upstream;
+}
+
+}